@@ -0,0 +1,444 @@
+#define _DEFAULT_SOURCE  // mkdtemp, realpath
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define DEFAULT_WRITERS 4
+#define DEFAULT_READERS 2
+#define DEFAULT_OPS 100
+#define HUNT_ID "stress"
+#define SEQ_LIMIT 100000           // Values encode writer * SEQ_LIMIT + sequence
+#define OUTPUT_LIMIT (64 << 20)    // Largest command output captured
+
+// Stress test for concurrent use of one hunt: 'writers' processes each add
+// 'ops' treasures with treasure_manager --add while 'readers' processes
+// alternate --list and --view on the same hunt. Reports throughput and
+// latency percentiles per command, then checks the hunt's integrity:
+//  - every add reported a distinct ID and every added treasure is listed
+//    exactly once, under that ID
+//  - no record (as listed by readers during the run, and as viewed
+//    afterwards) mixes fields of different treasures
+//  - logged_hunt holds one line per logged operation
+// Exits with status 1 if any check fails.
+//
+// Every treasure is derived from (writer, sequence): user "w<writer>",
+// value writer * 100000 + sequence, clue "clue <writer> <sequence>" and
+// location (writer, sequence / 1000), so any mix-up is detectable.
+//
+// Usage: hunt_stress <path/to/treasure_manager> [writers] [readers] [ops]
+
+// One command run by a worker, written to its result file
+typedef struct {
+    double latency_us;
+    int kind;                      // SAMPLE_*
+    int result;                    // Added ID, or 1 if a view found its treasure
+    int bad;                       // Records in the output that failed to check
+    int reserved;
+} Sample;
+
+enum { SAMPLE_ADD, SAMPLE_LIST, SAMPLE_VIEW, SAMPLE_KINDS };
+
+static const char *kind_names[SAMPLE_KINDS] = { "add", "list", "view" };
+static char manager_path[4096];
+static char *output;                // Output of the last command
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Run treasure_manager with args, feeding it input (if any) and capturing
+// its stdout in output. Returns its exit status, or -1 if it did not run.
+static int run_manager(const char *arg1, const char *arg2, const char *arg3, const char *input) {
+    int in_pipe[2], out_pipe[2];
+    size_t len = 0;
+    ssize_t bytes_read;
+    pid_t pid;
+    int status;
+
+    if (pipe(in_pipe) == -1 || pipe(out_pipe) == -1) {
+        return -1;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(in_pipe[0], STDIN_FILENO);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        execl(manager_path, "treasure_manager", arg1, arg2, arg3, (char *)NULL);
+        exit(EXIT_FAILURE);
+    }
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+
+    // Inputs are far below the pipe buffer, so this never blocks
+    if (input && write(in_pipe[1], input, strlen(input)) == -1) {
+        perror("Failed to write command input");
+    }
+    close(in_pipe[1]);
+
+    while ((bytes_read = read(out_pipe[0], output + len, OUTPUT_LIMIT - 1 - len)) > 0) {
+        len += bytes_read;
+    }
+    output[len] = '\0';
+    close(out_pipe[0]);
+
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+// Check that a listed "ID: n | User: u | Value: v" line is one treasure
+static int listed_line_ok(const char *line, int *id, int *value) {
+    int writer;
+
+    if (sscanf(line, "ID: %d | User: w%d | Value: %d", id, &writer, value) != 3) {
+        return 0;
+    }
+    return *value / SEQ_LIMIT == writer;
+}
+
+// Count the listed lines that fail to check
+static int check_listing(void) {
+    int bad = 0;
+    int id, value;
+
+    for (char *line = strstr(output, "\nID: "); line; line = strstr(line + 1, "\nID: ")) {
+        if (!listed_line_ok(line + 1, &id, &value)) {
+            bad++;
+        }
+    }
+    return bad;
+}
+
+// Check the output of --view against the treasure its value names.
+// Returns 1 if the treasure was found, 0 if not, -1 if it is torn.
+static int check_view(int treasure_id) {
+    int id, writer, value, clue_writer, clue_seq;
+    float latitude, longitude;
+    char *field;
+
+    if (!strstr(output, "Treasure Details:")) {
+        return 0;
+    }
+
+    if (!(field = strstr(output, "ID: ")) || sscanf(field, "ID: %d", &id) != 1 ||
+        !(field = strstr(output, "User: w")) || sscanf(field, "User: w%d", &writer) != 1 ||
+        !(field = strstr(output, "Location: ")) ||
+        sscanf(field, "Location: %f, %f", &latitude, &longitude) != 2 ||
+        !(field = strstr(output, "Clue: clue ")) ||
+        sscanf(field, "Clue: clue %d %d", &clue_writer, &clue_seq) != 2 ||
+        !(field = strstr(output, "Value: ")) || sscanf(field, "Value: %d", &value) != 1) {
+        return -1;
+    }
+
+    if (id != treasure_id || writer != clue_writer || value != writer * SEQ_LIMIT + clue_seq ||
+        (int)latitude != writer || (int)(longitude * 1000.0f + 0.5f) != clue_seq) {
+        return -1;
+    }
+    return 1;
+}
+
+// Worker process: run its commands and write one Sample per command
+static void run_worker(int worker, int is_writer, int ops, int writers, FILE *results) {
+    char input[256];
+    char id_str[16];
+    Sample sample;
+
+    srand(worker + 1);
+    for (int i = 0; i < ops; i++) {
+        double start;
+        int status;
+
+        memset(&sample, 0, sizeof(sample));
+        if (is_writer) {
+            snprintf(input, sizeof(input), "w%d\n%d\n%.3f\nclue %d %d\n%d\n", worker, worker,
+                     i / 1000.0, worker, i, worker * SEQ_LIMIT + i);
+            sample.kind = SAMPLE_ADD;
+            start = now_us();
+            status = run_manager("--add", HUNT_ID, NULL, input);
+            sample.latency_us = now_us() - start;
+
+            char *added = strstr(output, "successfully with ID ");
+            sample.result = added ? atoi(added + strlen("successfully with ID ")) : -1;
+            sample.bad = status != 0 || sample.result <= 0;
+        } else if (i % 2 == 0) {
+            sample.kind = SAMPLE_LIST;
+            start = now_us();
+            status = run_manager("--list", HUNT_ID, NULL, NULL);
+            sample.latency_us = now_us() - start;
+            sample.result = strstr(output, "Total treasures:") != NULL;
+            sample.bad = status != 0 || check_listing();
+        } else {
+            // Views of IDs that may not have been added yet are expected
+            int treasure_id = 1 + rand() % (writers * ops);
+            snprintf(id_str, sizeof(id_str), "%d", treasure_id);
+            sample.kind = SAMPLE_VIEW;
+            start = now_us();
+            status = run_manager("--view", HUNT_ID, id_str, NULL);
+            sample.latency_us = now_us() - start;
+            sample.result = check_view(treasure_id);
+            sample.bad = status != 0 || sample.result == -1;
+        }
+        fwrite(&sample, sizeof(sample), 1, results);
+    }
+}
+
+// Print throughput and latency percentiles of one kind of command
+static void report_kind(int kind, Sample *samples, size_t count, double elapsed_us) {
+    double *latencies = malloc((count + 1) * sizeof(double));
+    size_t n = 0;
+
+    for (size_t i = 0; latencies && i < count; i++) {
+        if (samples[i].kind == kind) {
+            latencies[n++] = samples[i].latency_us;
+        }
+    }
+    if (n > 0) {
+        qsort(latencies, n, sizeof(double), compare_doubles);
+        printf("%s: %zu ops, %.1f ops/s, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+               kind_names[kind], n, n / (elapsed_us / 1e6), latencies[n * 50 / 100] / 1e3,
+               latencies[n * 90 / 100] / 1e3, latencies[n * 99 / 100] / 1e3, latencies[n - 1] / 1e3);
+    }
+    free(latencies);
+}
+
+int main(int argc, char *argv[]) {
+    char dir_template[] = "/tmp/hunt_stress.XXXXXX";
+    int writers = DEFAULT_WRITERS;
+    int readers = DEFAULT_READERS;
+    int ops = DEFAULT_OPS;
+    int workers;
+    Sample *samples;
+    size_t sample_count = 0;
+    int *listed_ids;               // Listed ID of each (writer, sequence), 0 if none
+    int failures = 0;
+    double start, elapsed;
+
+    if (argc < 2) {
+        printf("Format: hunt_stress <path/to/treasure_manager> [writers] [readers] [ops]\n");
+        return 1;
+    }
+    if (argc > 2) {
+        writers = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        readers = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        ops = atoi(argv[4]);
+    }
+    if (writers < 1 || readers < 0 || ops < 1 || ops >= SEQ_LIMIT) {
+        printf("Need at least one writer and 1 to %d ops per process.\n", SEQ_LIMIT - 1);
+        return 1;
+    }
+    if (!realpath(argv[1], manager_path)) {
+        perror("Failed to resolve manager path");
+        return 1;
+    }
+
+    workers = writers + readers;
+    output = malloc(OUTPUT_LIMIT);
+    samples = malloc((size_t)workers * ops * sizeof(Sample));
+    listed_ids = calloc((size_t)writers * ops, sizeof(int));
+    if (!output || !samples || !listed_ids) {
+        perror("Failed to allocate buffers");
+        return 1;
+    }
+
+    if (!mkdtemp(dir_template) || chdir(dir_template) == -1) {
+        perror("Failed to create work directory");
+        return 1;
+    }
+
+    // Writers are workers 0 .. writers - 1
+    start = now_us();
+    for (int worker = 0; worker < workers; worker++) {
+        char results_path[32];
+        pid_t pid;
+
+        snprintf(results_path, sizeof(results_path), "results.%d", worker);
+        pid = fork();
+        if (pid == 0) {
+            FILE *results = fopen(results_path, "wb");
+            if (!results) {
+                exit(EXIT_FAILURE);
+            }
+            run_worker(worker, worker < writers, ops, writers, results);
+            exit(fclose(results) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        if (pid == -1) {
+            perror("Failed to start worker");
+            return 1;
+        }
+    }
+    while (wait(NULL) > 0) {
+    }
+    elapsed = now_us() - start;
+
+    for (int worker = 0; worker < workers; worker++) {
+        char results_path[32];
+        FILE *results;
+
+        snprintf(results_path, sizeof(results_path), "results.%d", worker);
+        results = fopen(results_path, "rb");
+        if (!results) {
+            fprintf(stderr, "Worker %d left no results\n", worker);
+            return 1;
+        }
+        if (fread(samples + sample_count, sizeof(Sample), ops, results) != (size_t)ops) {
+            fprintf(stderr, "Worker %d did not finish\n", worker);
+            return 1;
+        }
+        sample_count += ops;
+        fclose(results);
+        unlink(results_path);
+    }
+
+    printf("writers: %d\n", writers);
+    printf("readers: %d\n", readers);
+    printf("ops per process: %d\n", ops);
+    printf("wall time: %.2f s\n", elapsed / 1e6);
+    for (int kind = 0; kind < SAMPLE_KINDS; kind++) {
+        report_kind(kind, samples, sample_count, elapsed);
+    }
+
+    // Failed commands and torn records seen while the hunt was changing
+    long failed[SAMPLE_KINDS] = { 0 };
+    long adds = 0;
+    long expected_log_lines = 0;
+    for (size_t i = 0; i < sample_count; i++) {
+        failed[samples[i].kind] += samples[i].bad;
+        if (samples[i].kind == SAMPLE_ADD && !samples[i].bad) {
+            adds++;
+        }
+        // Every add and list is logged, and views only when found
+        if (!samples[i].bad && (samples[i].kind != SAMPLE_VIEW || samples[i].result == 1)) {
+            expected_log_lines++;
+        }
+    }
+    for (int kind = 0; kind < SAMPLE_KINDS; kind++) {
+        if (failed[kind]) {
+            printf("FAIL: %ld %s commands failed or returned torn records\n", failed[kind], kind_names[kind]);
+            failures++;
+        }
+    }
+
+    // The final listing holds every added treasure once, under its ID
+    long listed = 0, duplicates = 0, torn = 0;
+    if (run_manager("--list", HUNT_ID, NULL, NULL) != 0) {
+        printf("FAIL: final --list failed\n");
+        failures++;
+    }
+    expected_log_lines++;
+    for (char *line = strstr(output, "\nID: "); line; line = strstr(line + 1, "\nID: ")) {
+        int id, value;
+
+        if (!listed_line_ok(line + 1, &id, &value) || value % SEQ_LIMIT >= ops ||
+            value / SEQ_LIMIT >= writers) {
+            torn++;
+            continue;
+        }
+        int *slot = &listed_ids[(value / SEQ_LIMIT) * ops + value % SEQ_LIMIT];
+        if (*slot) {
+            duplicates++;
+        }
+        *slot = id;
+        listed++;
+    }
+
+    long mismatched = 0, duplicate_ids = 0;
+    char *seen = calloc((size_t)writers * ops + 2, 1);
+    for (size_t i = 0; seen && i < sample_count; i++) {
+        // Writer samples come first, so sample i is writer i / ops's add
+        // number i % ops
+        if (samples[i].kind != SAMPLE_ADD || samples[i].bad) {
+            continue;
+        }
+        int id = samples[i].result;
+        if (id > writers * ops || seen[id]) {
+            duplicate_ids++;
+        } else {
+            seen[id] = 1;
+        }
+        if (listed_ids[i] != id) {
+            mismatched++;
+        }
+    }
+    free(seen);
+
+    printf("treasures listed: %ld of %ld added\n", listed, adds);
+    if (listed != adds || duplicates || torn || mismatched || duplicate_ids) {
+        printf("FAIL: %ld duplicate IDs handed out, %ld treasures listed twice, %ld torn listed records, "
+               "%ld listed under another ID than the add reported\n",
+               duplicate_ids, duplicates, torn, mismatched);
+        failures++;
+    }
+
+    // View every treasure once more now that the hunt is quiet
+    long torn_views = 0;
+    for (long i = 0; i < (long)writers * ops; i++) {
+        char id_str[16];
+
+        if (!listed_ids[i]) {
+            continue;
+        }
+        snprintf(id_str, sizeof(id_str), "%d", listed_ids[i]);
+        if (run_manager("--view", HUNT_ID, id_str, NULL) != 0 || check_view(listed_ids[i]) != 1) {
+            torn_views++;
+        } else {
+            expected_log_lines++;
+        }
+    }
+    if (torn_views) {
+        printf("FAIL: %ld treasures viewed with fields of another treasure\n", torn_views);
+        failures++;
+    }
+
+    // One log line per logged operation, none lost or merged
+    long log_lines = 0;
+    FILE *log = fopen("hunts/" HUNT_ID "/logged_hunt", "r");
+    int c;
+    while (log && (c = fgetc(log)) != EOF) {
+        log_lines += c == '\n';
+    }
+    if (log) {
+        fclose(log);
+    }
+    printf("log lines: %ld of %ld expected\n", log_lines, expected_log_lines);
+    if (log_lines != expected_log_lines) {
+        printf("FAIL: log line count does not match the operations run\n");
+        failures++;
+    }
+
+    printf("integrity: %s\n", failures ? "FAILED" : "ok");
+
+    run_manager("--remove_hunt", HUNT_ID, NULL, NULL);
+    rmdir("hunts");
+    if (chdir("/") == 0) {
+        rmdir(dir_template);
+    }
+
+    free(listed_ids);
+    free(samples);
+    free(output);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+#define _DEFAULT_SOURCE  // mkdtemp, realpath, usleep, kill
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../monitor_protocol.h"
+
+#define DEFAULT_ITERATIONS 200
+
+// Measures how long the monitor takes to answer a command: from writing
+// a list_hunts request frame until its END frame has been read back from
+// the response pipe. Runs in an empty temp directory so only dispatch
+// cost is measured.
+//
+// Usage: monitor_latency <path/to/treasure_monitor> [iterations]
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Read exactly len bytes from fd
+static int read_full(int fd, void *data, size_t len) {
+    size_t done = 0;
+    
+    while (done < len) {
+        ssize_t bytes_read = read(fd, (char *)data + done, len - done);
+        if (bytes_read <= 0) {
+            return -1;
+        }
+        done += bytes_read;
+    }
+    return 0;
+}
+
+// Read response frames until the END frame of request_id
+static int read_until_end(int fd, uint32_t request_id) {
+    static char payload[MONITOR_MAX_DATA];
+    MonitorResponseHeader header;
+    
+    for (;;) {
+        if (read_full(fd, &header, sizeof(header)) == -1 ||
+            header.length > sizeof(payload) ||
+            read_full(fd, payload, header.length) == -1) {
+            return -1;
+        }
+        if (header.type == MONITOR_RESPONSE_END && header.request_id == request_id) {
+            return 0;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    char dir_template[] = "/tmp/monitor_latency.XXXXXX";
+    char monitor_path[4096];
+    int iterations = DEFAULT_ITERATIONS;
+    int request_pipe[2];
+    int response_pipe[2];
+    char request_fd_str[16];
+    char response_fd_str[16];
+    double *samples;
+    pid_t pid;
+    
+    if (argc < 2) {
+        printf("Format: monitor_latency <path/to/treasure_monitor> [iterations]\n");
+        return 1;
+    }
+    if (argc > 2) {
+        iterations = atoi(argv[2]);
+    }
+    if (!realpath(argv[1], monitor_path)) {
+        perror("Failed to resolve monitor path");
+        return 1;
+    }
+    
+    if (!mkdtemp(dir_template) || chdir(dir_template) == -1) {
+        perror("Failed to create work directory");
+        return 1;
+    }
+    mkdir("hunts", 0755);
+    
+    samples = malloc(iterations * sizeof(double));
+    if (!samples || pipe(request_pipe) == -1 || pipe(response_pipe) == -1) {
+        perror("Setup failed");
+        return 1;
+    }
+    
+    snprintf(request_fd_str, sizeof(request_fd_str), "%d", request_pipe[0]);
+    snprintf(response_fd_str, sizeof(response_fd_str), "%d", response_pipe[1]);
+    
+    pid = fork();
+    if (pid == 0) {
+        // The monitor's own messages are not part of the measurement
+        freopen("/dev/null", "w", stdout);
+        close(request_pipe[1]);
+        close(response_pipe[0]);
+        execl(monitor_path, "treasure_monitor", request_fd_str, response_fd_str, NULL);
+        perror("Exec failed");
+        exit(EXIT_FAILURE);
+    }
+    close(request_pipe[0]);
+    close(response_pipe[1]);
+    
+    srand(1);
+    for (int i = 0; i < iterations; i++) {
+        // Spread requests over any polling interval of the monitor
+        usleep(rand() % 20000);
+        
+        MonitorRequestHeader request;
+        memset(&request, 0, sizeof(request));
+        request.request_id = i + 1;
+        request.command = MONITOR_CMD_LIST_HUNTS;
+        
+        double start = now_us();
+        
+        if (write(request_pipe[1], &request, sizeof(request)) != sizeof(request) ||
+            read_until_end(response_pipe[0], request.request_id) == -1) {
+            fprintf(stderr, "Monitor stopped answering\n");
+            return 1;
+        }
+        samples[i] = now_us() - start;
+    }
+    
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    rmdir("hunts");
+    if (chdir("/") == 0) {
+        rmdir(dir_template);
+    }
+    
+    qsort(samples, iterations, sizeof(double), compare_doubles);
+    printf("iterations: %d\n", iterations);
+    printf("p50: %.1f us\n", samples[iterations * 50 / 100]);
+    printf("p99: %.1f us\n", samples[iterations * 99 / 100]);
+    printf("max: %.1f us\n", samples[iterations - 1]);
+    
+    free(samples);
+    return 0;
+}
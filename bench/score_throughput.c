@@ -0,0 +1,124 @@
+#define _DEFAULT_SOURCE  // mkstemp, realpath
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define DEFAULT_RECORDS 1000000
+#define DEFAULT_USERS 10000
+#define RUNS 3
+
+// Measures score_calculator throughput: generates 'records' lines of
+// name,value,owner input spread over 'users' owners, feeds the file to
+// the calculator on stdin and reports the best wall time of a few runs.
+//
+// Usage: score_throughput <path/to/score_calculator> [records] [users]
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Write the generated input to fd
+static int generate_input(int fd, long records, long users) {
+    FILE *file = fdopen(dup(fd), "w");
+
+    if (!file) {
+        return -1;
+    }
+
+    srand(1);
+    for (long i = 0; i < records; i++) {
+        fprintf(file, "item%ld,%d,user%ld\n", i, rand() % 100, (long)(rand() % users));
+    }
+
+    return fclose(file);
+}
+
+// Run the calculator once with stdin from input_fd, output discarded
+static double run_once(const char *calculator_path, int input_fd) {
+    double start = now_us();
+    pid_t pid;
+    int status;
+
+    lseek(input_fd, 0, SEEK_SET);
+    pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(input_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        execl(calculator_path, "score_calculator", NULL);
+        perror("Exec failed");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+
+    return now_us() - start;
+}
+
+int main(int argc, char *argv[]) {
+    char input_path[] = "/tmp/score_throughput.XXXXXX";
+    char calculator_path[4096];
+    long records = DEFAULT_RECORDS;
+    long users = DEFAULT_USERS;
+    double best = -1;
+    int input_fd;
+
+    if (argc < 2) {
+        printf("Format: score_throughput <path/to/score_calculator> [records] [users]\n");
+        return 1;
+    }
+    if (argc > 2) {
+        records = atol(argv[2]);
+    }
+    if (argc > 3) {
+        users = atol(argv[3]);
+    }
+    if (users < 1) {
+        users = 1;
+    }
+    if (!realpath(argv[1], calculator_path)) {
+        perror("Failed to resolve calculator path");
+        return 1;
+    }
+
+    input_fd = mkstemp(input_path);
+    if (input_fd == -1) {
+        perror("Failed to create input file");
+        return 1;
+    }
+    unlink(input_path);
+
+    if (generate_input(input_fd, records, users) == -1) {
+        perror("Failed to generate input");
+        return 1;
+    }
+
+    for (int i = 0; i < RUNS; i++) {
+        double elapsed = run_once(calculator_path, input_fd);
+        if (elapsed < 0) {
+            fprintf(stderr, "score_calculator failed\n");
+            return 1;
+        }
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    close(input_fd);
+
+    printf("records: %ld\n", records);
+    printf("users: %ld\n", users);
+    printf("time: %.1f ms\n", best / 1e3);
+    printf("throughput: %.0f records/s\n", records / (best / 1e6));
+
+    return 0;
+}
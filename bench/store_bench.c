@@ -0,0 +1,501 @@
+#define _XOPEN_SOURCE 600  // posix_openpt, grantpt, unlockpt, ptsname
+#define _DEFAULT_SOURCE    // mkdtemp, realpath, cfmakeraw
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../treasure_store.h"
+
+#define DEFAULT_SIZES "1000,100000,10000000"
+#define DEFAULT_USERS "10,1000,100000,1000000"
+#define DEFAULT_SCORE_RECORDS 1000000
+#define STORE_USERS 1000            // Owners of the records in the size hunts
+#define GENERATE_BATCH 4096         // Records encoded per write() when generating
+#define POINT_ITERATIONS 1000       // get_next_treasure_id and view_treasure calls
+#define REMOVE_ITERATIONS 200
+#define LIST_RECORD_BUDGET 20000000 // Records listed per size, over at least 3 runs
+#define SCORE_RUNS 5
+#define HUB_ITERATIONS 200
+#define HUB_TIMEOUT_MS 10000
+#define MAX_VALUES 16
+
+// Microbenchmarks for the hunt store, score_calculator and the hub. Runs
+// in a temp directory and prints one result row per benchmark as JSON (an
+// array of objects, the default) or CSV, so runs can be compared between
+// releases:
+//  - get_next_treasure_id, list_treasures, view_treasure and
+//    remove_treasure, called in-process on hunts of each size
+//  - score_calculator <hunt_id> on hunts with each number of users, with
+//    scores.dat missing (cold, as after a change) and current (warm)
+//  - list_hunts and view_treasure typed into treasure_hub, from the
+//    command to the next prompt (hub -> monitor -> store and back)
+// Latencies are in microseconds. Progress goes to stderr.
+//
+// Usage: store_bench [--format json|csv] [--sizes n,...] [--users n,...]
+//                    [--score_records n] [--bin <dir with the binaries>]
+
+typedef struct {
+    const char *name;
+    long records;
+    long users;
+    int iterations;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double min;
+    double max;
+} BenchResult;
+
+static FILE *results;               // The real stdout; fd 1 goes to /dev/null
+static int csv = 0;
+static int rows = 0;
+static char bin_dir[4096];
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Summarize samples (sorted in place) and print the result row
+static void report(const char *name, long records, long users, double *samples, int count) {
+    BenchResult result = { name, records, users, count, 0, 0, 0, 0, 0, 0 };
+
+    if (count == 0) {
+        return;
+    }
+    qsort(samples, count, sizeof(double), compare_doubles);
+    for (int i = 0; i < count; i++) {
+        result.mean += samples[i] / count;
+    }
+    result.p50 = samples[count * 50 / 100];
+    result.p90 = samples[count * 90 / 100];
+    result.p99 = samples[count * 99 / 100];
+    result.min = samples[0];
+    result.max = samples[count - 1];
+
+    if (csv) {
+        if (rows == 0) {
+            fprintf(results, "benchmark,records,users,iterations,mean_us,p50_us,p90_us,p99_us,min_us,max_us\n");
+        }
+        fprintf(results, "%s,%ld,%ld,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", result.name, result.records,
+                result.users, result.iterations, result.mean, result.p50, result.p90, result.p99,
+                result.min, result.max);
+    } else {
+        fprintf(results, "%s\n  {\"benchmark\": \"%s\", \"records\": %ld, \"users\": %ld, \"iterations\": %d, "
+                "\"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+                "\"min_us\": %.1f, \"max_us\": %.1f}", rows == 0 ? "[" : ",", result.name, result.records,
+                result.users, result.iterations, result.mean, result.p50, result.p90, result.p99,
+                result.min, result.max);
+    }
+    fflush(results);
+    rows++;
+}
+
+// Parse a comma-separated list of counts. Returns how many were read.
+static int parse_counts(const char *text, long *values) {
+    int count = 0;
+    char *end;
+
+    while (*text && count < MAX_VALUES) {
+        values[count] = strtol(text, &end, 10);
+        if (end == text || values[count] < 1) {
+            return 0;
+        }
+        count++;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+// Write a hunt of 'records' treasures owned by 'users' users straight
+// through the store, then build its meta block and ID index
+static int generate_hunt(const char *hunt_id, long records, long users) {
+    static Treasure batch[GENERATE_BATCH];
+    static char encoded[GENERATE_BATCH * sizeof(Treasure)];
+    HuntMeta meta;
+    int fd, format;
+
+    ensure_hunt_directory(hunt_id);
+    fd = open_treasure_append(hunt_id, &format);
+    if (fd == -1) {
+        return -1;
+    }
+
+    srand(1);
+    for (long i = 0; i < records; i += GENERATE_BATCH) {
+        size_t count = records - i < GENERATE_BATCH ? (size_t)(records - i) : GENERATE_BATCH;
+        size_t len;
+
+        for (size_t j = 0; j < count; j++) {
+            Treasure *treasure = &batch[j];
+            long n = i + (long)j;
+
+            memset(treasure, 0, sizeof(*treasure));
+            treasure->id = (int)(n + 1);
+            snprintf(treasure->username, MAX_USERNAME, "user%ld", (long)(rand() % users));
+            treasure->latitude = (float)(rand() % 180000) / 1000.0f - 90.0f;
+            treasure->longitude = (float)(rand() % 360000) / 1000.0f - 180.0f;
+            snprintf(treasure->clue, MAX_CLUE, "Clue number %ld", n + 1);
+            treasure->value = rand() % 100;
+            treasure->is_active = 1;
+        }
+
+        len = encode_treasures(hunt_id, format, batch, count, encoded, 0, NULL);
+        if (len == 0 || write(fd, encoded, len) != (ssize_t)len) {
+            perror("Failed to write treasures");
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+
+    if (rebuild_hunt_meta(hunt_id, &meta) == -1 || rebuild_treasure_index(hunt_id) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// The store operations on a hunt of 'records' treasures
+static int bench_store(long records, double *samples) {
+    char hunt_id[32];
+    int iterations;
+    double start;
+
+    snprintf(hunt_id, sizeof(hunt_id), "size%ld", records);
+    fprintf(stderr, "Generating %ld records...\n", records);
+    if (generate_hunt(hunt_id, records, STORE_USERS) == -1) {
+        return -1;
+    }
+
+    // Each benchmark starts with an untimed call to warm the caches
+    get_next_treasure_id(hunt_id);
+    for (int i = 0; i < POINT_ITERATIONS; i++) {
+        start = now_us();
+        get_next_treasure_id(hunt_id);
+        samples[i] = now_us() - start;
+    }
+    report("get_next_treasure_id", records, STORE_USERS, samples, POINT_ITERATIONS);
+
+    iterations = (int)(LIST_RECORD_BUDGET / records);
+    iterations = iterations < 3 ? 3 : iterations > POINT_ITERATIONS ? POINT_ITERATIONS : iterations;
+    list_treasures(hunt_id);
+    for (int i = 0; i < iterations; i++) {
+        start = now_us();
+        list_treasures(hunt_id);
+        samples[i] = now_us() - start;
+    }
+    report("list_treasures", records, STORE_USERS, samples, iterations);
+
+    srand(2);
+    view_treasure(hunt_id, 1);
+    for (int i = 0; i < POINT_ITERATIONS; i++) {
+        int treasure_id = 1 + (int)(((long)rand() * RAND_MAX + rand()) % records);
+        start = now_us();
+        view_treasure(hunt_id, treasure_id);
+        samples[i] = now_us() - start;
+    }
+    report("view_treasure", records, STORE_USERS, samples, POINT_ITERATIONS);
+
+    // Evenly spaced IDs, so each removal finds a treasure
+    iterations = records < REMOVE_ITERATIONS ? (int)records : REMOVE_ITERATIONS;
+    for (int i = 0; i < iterations; i++) {
+        int treasure_id = 1 + (int)(i * (records / iterations));
+        start = now_us();
+        remove_treasure(hunt_id, treasure_id);
+        samples[i] = now_us() - start;
+    }
+    report("remove_treasure", records, STORE_USERS, samples, iterations);
+
+    return 0;
+}
+
+// Run a binary from the bin directory with its stdout discarded and
+// return its wall time, or -1 if it failed
+static double run_timed(const char *binary, const char *arg) {
+    char path[sizeof(bin_dir) + 32];
+    double start = now_us();
+    pid_t pid;
+    int status;
+
+    snprintf(path, sizeof(path), "%s/%s", bin_dir, binary);
+    pid = fork();
+    if (pid == 0) {
+        execl(path, binary, arg, (char *)NULL);
+        perror("Exec failed");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return now_us() - start;
+}
+
+// score_calculator on a hunt whose records are spread over 'users' users
+static int bench_scores(long records, long users, double *samples) {
+    char hunt_id[32];
+
+    snprintf(hunt_id, sizeof(hunt_id), "users%ld", users);
+    fprintf(stderr, "Generating %ld records for %ld users...\n", records, users);
+    if (generate_hunt(hunt_id, records, users) == -1) {
+        return -1;
+    }
+
+    for (int i = 0; i < SCORE_RUNS; i++) {
+        unlink(get_scores_file_path(hunt_id));
+        if ((samples[i] = run_timed("score_calculator", hunt_id)) < 0) {
+            fprintf(stderr, "score_calculator failed\n");
+            return -1;
+        }
+    }
+    report("calculate_score_cold", records, users, samples, SCORE_RUNS);
+
+    for (int i = 0; i < SCORE_RUNS; i++) {
+        if ((samples[i] = run_timed("score_calculator", hunt_id)) < 0) {
+            fprintf(stderr, "score_calculator failed\n");
+            return -1;
+        }
+    }
+    report("calculate_score_warm", records, users, samples, SCORE_RUNS);
+
+    remove_hunt(hunt_id);
+    return 0;
+}
+
+// Read hub output until it shows its prompt again. The hub runs on a
+// terminal, so its prompt is flushed before it waits for a command.
+// Returns 0 on success, -1 on timeout or error.
+static int wait_for_prompt(int master_fd, char *seen, size_t size) {
+    char buffer[4096];
+    size_t len = 0;
+    struct pollfd pfd = { master_fd, POLLIN, 0 };
+
+    for (;;) {
+        ssize_t bytes_read;
+
+        if (poll(&pfd, 1, HUB_TIMEOUT_MS) <= 0) {
+            return -1;
+        }
+        bytes_read = read(master_fd, buffer, sizeof(buffer));
+        if (bytes_read <= 0) {
+            return -1;
+        }
+        if (seen && len + 1 < size) {
+            size_t copy = (size_t)bytes_read < size - 1 - len ? (size_t)bytes_read : size - 1 - len;
+            memcpy(seen + len, buffer, copy);
+            len += copy;
+            seen[len] = '\0';
+        }
+        if (bytes_read >= 2 && memcmp(buffer + bytes_read - 2, "> ", 2) == 0) {
+            return 0;
+        }
+    }
+}
+
+// Type a command into the hub and time it until the next prompt
+static double hub_command(int master_fd, const char *command) {
+    double start = now_us();
+
+    if (write(master_fd, command, strlen(command)) != (ssize_t)strlen(command) ||
+        wait_for_prompt(master_fd, NULL, 0) == -1) {
+        return -1;
+    }
+    return now_us() - start;
+}
+
+// Commands through treasure_hub and its monitor on the hunt of 'records'
+// treasures
+static int bench_hub(long records, double *samples) {
+    char hunt_id[32];
+    char link_path[sizeof(bin_dir) + 32];
+    char command[128];
+    char started[4096];
+    struct termios mode;
+    char *pid_text;
+    pid_t hub_pid, monitor_pid = -1;
+    int master_fd;
+    int status = 0;
+
+    snprintf(hunt_id, sizeof(hunt_id), "size%ld", records);
+
+    // The hub starts ./treasure_monitor from its working directory
+    snprintf(link_path, sizeof(link_path), "%s/treasure_monitor", bin_dir);
+    unlink("treasure_monitor");
+    if (symlink(link_path, "treasure_monitor") == -1) {
+        perror("Failed to link treasure_monitor");
+        return -1;
+    }
+
+    master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd == -1 || grantpt(master_fd) == -1 || unlockpt(master_fd) == -1) {
+        perror("Failed to open a terminal for the hub");
+        return -1;
+    }
+
+    hub_pid = fork();
+    if (hub_pid == 0) {
+        int slave_fd = open(ptsname(master_fd), O_RDWR);
+
+        // No echo or line editing: the hub sees exactly what is typed
+        tcgetattr(slave_fd, &mode);
+        cfmakeraw(&mode);
+        tcsetattr(slave_fd, TCSANOW, &mode);
+        dup2(slave_fd, STDIN_FILENO);
+        dup2(slave_fd, STDOUT_FILENO);
+        dup2(slave_fd, STDERR_FILENO);
+        close(master_fd);
+        snprintf(link_path, sizeof(link_path), "%s/treasure_hub", bin_dir);
+        execl(link_path, "treasure_hub", (char *)NULL);
+        exit(EXIT_FAILURE);
+    }
+
+    if (hub_pid == -1 || wait_for_prompt(master_fd, NULL, 0) == -1 ||
+        write(master_fd, "start_monitor\n", 14) != 14 ||
+        wait_for_prompt(master_fd, started, sizeof(started)) == -1 ||
+        !(pid_text = strstr(started, "PID: "))) {
+        fprintf(stderr, "treasure_hub did not start its monitor\n");
+        status = -1;
+    } else {
+        monitor_pid = atoi(pid_text + 5);
+
+        hub_command(master_fd, "list_hunts\n");
+        for (int i = 0; status == 0 && i < HUB_ITERATIONS; i++) {
+            if ((samples[i] = hub_command(master_fd, "list_hunts\n")) < 0) {
+                status = -1;
+            }
+        }
+        if (status == 0) {
+            report("hub_list_hunts", records, STORE_USERS, samples, HUB_ITERATIONS);
+        }
+
+        srand(3);
+        for (int i = 0; status == 0 && i < HUB_ITERATIONS; i++) {
+            snprintf(command, sizeof(command), "view_treasure %s %ld\n", hunt_id, 1 + rand() % records);
+            if ((samples[i] = hub_command(master_fd, command)) < 0) {
+                status = -1;
+            }
+        }
+        if (status == 0) {
+            report("hub_view_treasure", records, STORE_USERS, samples, HUB_ITERATIONS);
+        } else {
+            fprintf(stderr, "treasure_hub stopped answering\n");
+        }
+    }
+
+    // The monitor delays its exit on purpose; nothing is left to wait for
+    if (monitor_pid > 0) {
+        kill(monitor_pid, SIGKILL);
+    }
+    kill(hub_pid, SIGKILL);
+    waitpid(hub_pid, NULL, 0);
+    close(master_fd);
+    unlink("treasure_monitor");
+
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    char dir_template[] = "/tmp/store_bench.XXXXXX";
+    long sizes[MAX_VALUES], user_counts[MAX_VALUES];
+    int size_count = parse_counts(DEFAULT_SIZES, sizes);
+    int user_count = parse_counts(DEFAULT_USERS, user_counts);
+    long score_records = DEFAULT_SCORE_RECORDS;
+    const char *bin = ".";
+    double *samples;
+    int null_fd;
+    int status = 0;
+    int i;
+
+    for (i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--format") == 0 && (strcmp(argv[i + 1], "json") == 0 ||
+                                                 strcmp(argv[i + 1], "csv") == 0)) {
+            csv = strcmp(argv[i + 1], "csv") == 0;
+        } else if (strcmp(argv[i], "--sizes") == 0 && (size_count = parse_counts(argv[i + 1], sizes)) > 0) {
+            continue;
+        } else if (strcmp(argv[i], "--users") == 0 && (user_count = parse_counts(argv[i + 1], user_counts)) > 0) {
+            continue;
+        } else if (strcmp(argv[i], "--score_records") == 0 && (score_records = atol(argv[i + 1])) > 0) {
+            continue;
+        } else if (strcmp(argv[i], "--bin") == 0) {
+            bin = argv[i + 1];
+        } else {
+            break;
+        }
+    }
+    if (i != argc) {
+        printf("Format: store_bench [--format json|csv] [--sizes n,...] [--users n,...]\n");
+        printf("                    [--score_records n] [--bin <dir with the binaries>]\n");
+        return 1;
+    }
+    if (!realpath(bin, bin_dir)) {
+        perror("Failed to resolve binary directory");
+        return 1;
+    }
+
+    samples = malloc(POINT_ITERATIONS * sizeof(double));
+    if (!samples) {
+        perror("Failed to allocate samples");
+        return 1;
+    }
+
+    // Results go to the real stdout; the store's own output is discarded
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    null_fd = open("/dev/null", O_WRONLY);
+    if (!results || null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1) {
+        perror("Failed to redirect output");
+        return 1;
+    }
+    close(null_fd);
+
+    if (!mkdtemp(dir_template) || chdir(dir_template) == -1) {
+        perror("Failed to create work directory");
+        return 1;
+    }
+    mkdir("hunts", 0755);
+
+    for (i = 0; status == 0 && i < size_count; i++) {
+        status = bench_store(sizes[i], samples);
+    }
+    for (i = 0; status == 0 && i < user_count; i++) {
+        status = bench_scores(score_records, user_counts[i], samples);
+    }
+    if (status == 0) {
+        status = bench_hub(sizes[0], samples);
+    }
+
+    for (i = 0; i < size_count; i++) {
+        char hunt_id[32];
+        snprintf(hunt_id, sizeof(hunt_id), "size%ld", sizes[i]);
+        remove_hunt(hunt_id);
+    }
+    rmdir("hunts");
+    if (chdir("/") == 0) {
+        rmdir(dir_template);
+    }
+
+    if (!csv && rows > 0) {
+        fprintf(results, "\n]\n");
+    }
+    fclose(results);
+    free(samples);
+
+    return status == 0 ? 0 : 1;
+}
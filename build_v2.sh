@@ -3,21 +3,33 @@
 
 CC="gcc"
 CFLAGS="-Wall -Wextra -std=c99 -pedantic"
-LDFLAGS=""
+LDFLAGS="-lm"
 
 echo "Building treasure hunt system..."
 
+# Build the shared treasure store used by treasure_manager, treasure_monitor and score_calculator
+echo "Compiling treasure store..."
+$CC $CFLAGS -c -o treasure_store.o treasure_store.c && $CC $CFLAGS -c -o outbuf.o outbuf.c && \
+    $CC $CFLAGS -c -o score_table.o score_table.c && \
+    $CC $CFLAGS -c -o treasure_columns.o treasure_columns.c && $CC $CFLAGS -c -o user_dict.o user_dict.c && \
+    $CC $CFLAGS -c -o spatial_index.o spatial_index.c && $CC $CFLAGS -c -o hunt_log.o hunt_log.c && \
+    $CC $CFLAGS -c -o hunt_journal.o hunt_journal.c
+if [ $? -ne 0 ]; then
+    echo "Error: Failed to compile treasure store"
+    exit 1
+fi
+
 # Build score_calculator
 echo "Compiling score_calculator..."
-$CC $CFLAGS -o score_calculator score_calculator.c $LDFLAGS
+$CC $CFLAGS -o score_calculator score_calculator.c treasure_store.o treasure_columns.o user_dict.o spatial_index.o hunt_log.o hunt_journal.o outbuf.o score_table.o $LDFLAGS
 if [ $? -ne 0 ]; then
-    echo "Error: Failed to compile treasure_manager"
+    echo "Error: Failed to compile score_calculator"
     exit 1
 fi
 
 # Build treasure_manager
 echo "Compiling treasure_manager..."
-$CC $CFLAGS -o treasure_manager treasure_manager_v2.c $LDFLAGS
+$CC $CFLAGS -o treasure_manager treasure_manager_v2.c treasure_store.o treasure_columns.o user_dict.o spatial_index.o hunt_log.o hunt_journal.o outbuf.o score_table.o $LDFLAGS
 if [ $? -ne 0 ]; then
     echo "Error: Failed to compile treasure_manager"
     exit 1
@@ -25,7 +37,7 @@ fi
 
 # Build treasure_monitor
 echo "Compiling treasure_monitor..."
-$CC $CFLAGS -o treasure_monitor treasure_monitor.c $LDFLAGS
+$CC $CFLAGS -o treasure_monitor treasure_monitor.c treasure_store.o treasure_columns.o user_dict.o spatial_index.o hunt_log.o hunt_journal.o outbuf.o score_table.o $LDFLAGS
 if [ $? -ne 0 ]; then
     echo "Error: Failed to compile treasure_monitor"
     exit 1
@@ -33,7 +45,7 @@ fi
 
 # Build treasure_hub
 echo "Compiling treasure_hub..."
-$CC $CFLAGS -o treasure_hub treasure_hub_v2.c $LDFLAGS
+$CC $CFLAGS -o treasure_hub treasure_hub_v2.c outbuf.o score_table.o $LDFLAGS
 if [ $? -ne 0 ]; then
     echo "Error: Failed to compile treasure_hub"
     exit 1
@@ -45,3 +57,23 @@ echo "You can now run the treasure hunt system with './treasure_hub'"
 # Make the script executable
 chmod +x treasure_hub
 chmod +x treasure_monitor
+
+# Build the benchmarks with './build_v2.sh bench'
+if [ "$1" = "bench" ] || [ "$1" = "stress" ]; then
+    echo "Compiling benchmarks..."
+    $CC $CFLAGS -O2 -o bench/monitor_latency bench/monitor_latency.c $LDFLAGS && \
+    $CC $CFLAGS -O2 -o bench/score_throughput bench/score_throughput.c $LDFLAGS && \
+    $CC $CFLAGS -O2 -o bench/hunt_stress bench/hunt_stress.c $LDFLAGS && \
+    $CC $CFLAGS -O2 -o bench/store_bench bench/store_bench.c treasure_store.o treasure_columns.o user_dict.o spatial_index.o hunt_log.o hunt_journal.o outbuf.o score_table.o $LDFLAGS
+    if [ $? -ne 0 ]; then
+        echo "Error: Failed to compile benchmarks"
+        exit 1
+    fi
+    echo "Benchmarks built in bench/"
+fi
+
+# Run the concurrency stress test with './build_v2.sh stress [writers] [readers] [ops]'
+if [ "$1" = "stress" ]; then
+    shift
+    ./bench/hunt_stress ./treasure_manager "$@" || exit 1
+fi
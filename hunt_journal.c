@@ -0,0 +1,377 @@
+#define _DEFAULT_SOURCE  // pread/pwrite, fdatasync, ftruncate
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "treasure_store.h"
+#include "hunt_journal.h"
+
+// Lock file of a hunt held open by this process. fcntl locks belong to the
+// process and are dropped when any descriptor of the file is closed, so
+// each lock file is opened once and nested locks only count depth.
+typedef struct {
+    char hunt_id[MAX_PATH];
+    int fd;                        // -1 while the slot is unused
+    int depth;                     // Nested lock_hunt() calls holding the lock
+    int mode;                      // HUNT_LOCK_READ or HUNT_LOCK_WRITE while held
+} HuntLock;
+
+static HuntLock lock_cache[LOCK_CACHE_SIZE];
+static int lock_cache_ready = 0;
+static int lock_cache_next = 0;     // Slot tried first by the next miss
+
+static int journal_fd = -1;         // Journal of the operation in progress, if any
+
+// Get the path to the lock file of a hunt
+char* get_lock_file_path(const char *hunt_id) {
+    static char lock_path[MAX_PATH];
+    
+    strcpy(lock_path, HUNT_DIR_PREFIX);
+    strcat(lock_path, hunt_id);
+    strcat(lock_path, "/lock");
+    
+    return lock_path;
+}
+
+// Get the path to the journal of a hunt
+char* get_journal_path(const char *hunt_id) {
+    static char journal_path[MAX_PATH];
+    
+    strcpy(journal_path, HUNT_DIR_PREFIX);
+    strcat(journal_path, hunt_id);
+    strcat(journal_path, "/journal");
+    
+    return journal_path;
+}
+
+// Take, convert or release (F_UNLCK) the lock on a whole lock file,
+// waiting for other processes. Returns 0 on success, -1 on error.
+static int set_lock(int fd, short type) {
+    struct flock lock;
+    
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+    
+    while (fcntl(fd, F_SETLKW, &lock) == -1) {
+        if (errno != EINTR) {
+            perror("Failed to lock hunt");
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+static uint32_t journal_checksum(const JournalEntry *entry) {
+    JournalEntry copy = *entry;
+    const unsigned char *bytes = (const unsigned char *)&copy;
+    uint32_t hash = 2166136261u;
+    
+    copy.checksum = 0;
+    for (size_t i = 0; i < sizeof(copy); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    
+    return hash;
+}
+
+// Lock a hunt for reading (shared) or writing (exclusive), waiting for
+// other processes. Locks nest: only the outermost unlock_hunt() releases
+// it, and a write lock must be the outermost one. The first lock also rolls back an operation a crashed writer left
+// in the journal. A hunt without a directory is not locked. Returns 0 on
+// success, -1 on error.
+int lock_hunt(const char *hunt_id, int mode) {
+    HuntLock *lock = NULL;
+    struct stat file_stat;
+    
+    if (!lock_cache_ready) {
+        for (int i = 0; i < LOCK_CACHE_SIZE; i++) {
+            lock_cache[i].fd = -1;
+        }
+        lock_cache_ready = 1;
+    }
+    
+    for (int i = 0; i < LOCK_CACHE_SIZE; i++) {
+        if (lock_cache[i].fd != -1 && strcmp(lock_cache[i].hunt_id, hunt_id) == 0) {
+            lock = &lock_cache[i];
+            break;
+        }
+    }
+    
+    // Already held: count the nesting. A shared lock is never upgraded in
+    // place, as two readers doing so would wait on each other; writers
+    // take their lock first.
+    if (lock && lock->depth > 0) {
+        if (mode == HUNT_LOCK_WRITE && lock->mode == HUNT_LOCK_READ) {
+            fprintf(stderr, "Hunt '%s' is locked for reading; cannot lock it for writing\n", hunt_id);
+            return -1;
+        }
+        lock->depth++;
+        return 0;
+    }
+    
+    for (;;) {
+        if (!lock) {
+            // Take over a slot that holds no lock
+            for (int i = 0; i < LOCK_CACHE_SIZE && !lock; i++) {
+                HuntLock *slot = &lock_cache[(lock_cache_next + i) % LOCK_CACHE_SIZE];
+                if (slot->depth == 0) {
+                    lock = slot;
+                    lock_cache_next = (lock_cache_next + i + 1) % LOCK_CACHE_SIZE;
+                }
+            }
+            if (!lock) {
+                fprintf(stderr, "Too many hunts locked at once\n");
+                return -1;
+            }
+            if (lock->fd != -1) {
+                close(lock->fd);
+            }
+            
+            lock->fd = open(get_lock_file_path(hunt_id), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (lock->fd == -1) {
+                if (errno == ENOENT || errno == ENOTDIR) {
+                    return 0;
+                }
+                perror("Failed to open hunt lock");
+                return -1;
+            }
+            strncpy(lock->hunt_id, hunt_id, MAX_PATH - 1);
+            lock->hunt_id[MAX_PATH - 1] = '\0';
+        }
+        
+        if (set_lock(lock->fd, mode == HUNT_LOCK_WRITE ? F_WRLCK : F_RDLCK) == -1) {
+            return -1;
+        }
+        
+        // The hunt was removed while we waited: lock the new file, if any
+        if (fstat(lock->fd, &file_stat) == 0 && file_stat.st_nlink == 0) {
+            close(lock->fd);
+            lock->fd = -1;
+            lock = NULL;
+            continue;
+        }
+        break;
+    }
+    
+    lock->depth = 1;
+    lock->mode = mode;
+    
+    // An interrupted operation is repaired under an exclusive lock. A
+    // reader lets go of its shared lock first: two readers upgrading in
+    // place would wait on each other. Whoever gets the lock first does the
+    // recovery, and the rest find an empty journal.
+    if (stat(get_journal_path(hunt_id), &file_stat) == 0 && file_stat.st_size > 0) {
+        if (mode == HUNT_LOCK_READ) {
+            set_lock(lock->fd, F_UNLCK);
+            if (set_lock(lock->fd, F_WRLCK) == -1) {
+                lock->depth = 0;
+                return -1;
+            }
+        }
+        journal_recover(hunt_id);
+        if (mode == HUNT_LOCK_READ) {
+            set_lock(lock->fd, F_RDLCK);
+        }
+    }
+    
+    return 0;
+}
+
+// Release one level of a hunt's lock
+void unlock_hunt(const char *hunt_id) {
+    for (int i = 0; lock_cache_ready && i < LOCK_CACHE_SIZE; i++) {
+        HuntLock *lock = &lock_cache[i];
+        
+        if (lock->fd != -1 && lock->depth > 0 && strcmp(lock->hunt_id, hunt_id) == 0) {
+            if (--lock->depth == 0) {
+                set_lock(lock->fd, F_UNLCK);
+            }
+            return;
+        }
+    }
+}
+
+// Whether this process holds the hunt's write lock
+int hunt_locked_for_write(const char *hunt_id) {
+    for (int i = 0; lock_cache_ready && i < LOCK_CACHE_SIZE; i++) {
+        HuntLock *lock = &lock_cache[i];
+        
+        if (lock->fd != -1 && strcmp(lock->hunt_id, hunt_id) == 0) {
+            return lock->depth > 0 && lock->mode == HUNT_LOCK_WRITE;
+        }
+    }
+    
+    return 0;
+}
+
+// Record the intent of a change to treasures.dat before making it, if the
+// hunt is journaled (the caller holds the hunt's write lock). Returns 0 on
+// success, -1 if the intent could not be made durable.
+int journal_begin(const char *hunt_id, int op, int treasure_id, int format, off_t offset) {
+    JournalEntry entry;
+    HuntMeta meta;
+    
+    if (read_hunt_meta(hunt_id, &meta) == -1 || !(meta.flags & META_JOURNALED)) {
+        return 0;
+    }
+    
+    memset(&entry, 0, sizeof(entry));
+    entry.magic = JOURNAL_MAGIC;
+    entry.version = JOURNAL_VERSION;
+    entry.op = (uint32_t)op;
+    entry.treasure_id = treasure_id;
+    entry.offset = offset;
+    entry.generation = meta.generation;
+    entry.format = (uint32_t)format;
+    entry.checksum = journal_checksum(&entry);
+    
+    journal_fd = open(get_journal_path(hunt_id), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (journal_fd == -1) {
+        perror("Failed to open journal");
+        return -1;
+    }
+    if (pwrite(journal_fd, &entry, sizeof(entry), 0) != sizeof(entry) || fdatasync(journal_fd) == -1) {
+        perror("Failed to write journal");
+        close(journal_fd);
+        journal_fd = -1;
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Finish the journaled operation in progress: make the treasure file and
+// the meta block durable, then clear the intent. Does nothing if no
+// intent was written. Returns 0 on success, -1 on error.
+int journal_commit(const char *hunt_id, int data_fd) {
+    int meta_fd;
+    int status = 0;
+    
+    if (journal_fd == -1) {
+        return 0;
+    }
+    
+    meta_fd = open(get_meta_file_path(hunt_id), O_RDONLY);
+    if ((data_fd != -1 && fdatasync(data_fd) == -1) || meta_fd == -1 || fdatasync(meta_fd) == -1 ||
+        ftruncate(journal_fd, 0) == -1) {
+        perror("Failed to commit journal");
+        status = -1;
+    }
+    if (meta_fd != -1) {
+        close(meta_fd);
+    }
+    
+    close(journal_fd);
+    journal_fd = -1;
+    return status;
+}
+
+// Repair a hunt after an operation that did not finish: roll back the
+// change its journal describes (truncate appended records, restore a
+// removed one) and rebuild the meta block and ID index. The caller holds
+// the hunt's write lock. Returns 0 on success, -1 on error.
+int journal_recover(const char *hunt_id) {
+    JournalEntry entry;
+    struct stat file_stat;
+    HuntMeta meta;
+    Treasure treasure;
+    int fd, data_fd;
+    
+    fd = open(get_journal_path(hunt_id), O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    
+    // A torn or empty intent was never complete, so nothing was touched
+    if (pread(fd, &entry, sizeof(entry), 0) != sizeof(entry) || entry.magic != JOURNAL_MAGIC ||
+        entry.version != JOURNAL_VERSION || entry.checksum != journal_checksum(&entry)) {
+        ftruncate(fd, 0);
+        close(fd);
+        return 0;
+    }
+    
+    data_fd = open(get_treasure_file_path(hunt_id), O_RDWR);
+    if (data_fd == -1 || fstat(data_fd, &file_stat) == -1) {
+        if (data_fd != -1) {
+            close(data_fd);
+        }
+        ftruncate(fd, 0);
+        close(fd);
+        return errno == ENOENT ? 0 : -1;
+    }
+    
+    // The meta block moved on and matches the file: the operation finished
+    if (read_hunt_meta(hunt_id, &meta) == 0 && meta.generation != entry.generation &&
+        meta.data_size == file_stat.st_size) {
+        close(data_fd);
+        ftruncate(fd, 0);
+        close(fd);
+        return 0;
+    }
+    
+    if (entry.op == JOURNAL_OP_APPEND) {
+        if (file_stat.st_size > entry.offset && ftruncate(data_fd, entry.offset) == -1) {
+            perror("Failed to roll back treasure file");
+            close(data_fd);
+            close(fd);
+            return -1;
+        }
+        fprintf(stderr, "Rolled back an interrupted add of treasure ID %d onwards in hunt '%s'\n",
+                entry.treasure_id, hunt_id);
+    } else if (entry.op == JOURNAL_OP_REMOVE) {
+        if (read_treasure_at(hunt_id, data_fd, (int)entry.format, entry.offset, &treasure) == 0 &&
+            treasure.id == entry.treasure_id && !treasure.is_active) {
+            set_treasure_active(data_fd, (int)entry.format, entry.offset, 1);
+        }
+        fprintf(stderr, "Rolled back an interrupted removal of treasure ID %d in hunt '%s'\n",
+                entry.treasure_id, hunt_id);
+    }
+    
+    fdatasync(data_fd);
+    close(data_fd);
+    
+    rebuild_hunt_meta(hunt_id, &meta);
+    rebuild_treasure_index(hunt_id);
+    
+    ftruncate(fd, 0);
+    fdatasync(fd);
+    close(fd);
+    return 0;
+}
+
+// Turn journaled mode on or off for a hunt
+void set_journaled(const char *hunt_id, int enable) {
+    struct stat file_stat;
+    HuntMeta meta;
+    
+    if (stat(get_treasure_file_path(hunt_id), &file_stat) == -1) {
+        printf("Hunt '%s' has no treasures or does not exist.\n", hunt_id);
+        return;
+    }
+    
+    if (lock_hunt(hunt_id, HUNT_LOCK_WRITE) == -1) {
+        return;
+    }
+    
+    if (load_hunt_meta(hunt_id, &meta, file_stat.st_size) == 0) {
+        meta.flags = enable ? (meta.flags | META_JOURNALED) : (meta.flags & ~META_JOURNALED);
+        if (write_hunt_meta(hunt_id, &meta) == 0) {
+            if (!enable) {
+                unlink(get_journal_path(hunt_id));
+            }
+            printf("Hunt '%s' %s journaled.\n", hunt_id, enable ? "is now" : "is no longer");
+        }
+    }
+    
+    unlock_hunt(hunt_id);
+}
@@ -0,0 +1,47 @@
+#ifndef HUNT_JOURNAL_H
+#define HUNT_JOURNAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "treasure_store.h"
+
+#define HUNT_LOCK_READ 0            // Shared: queries of a hunt
+#define HUNT_LOCK_WRITE 1           // Exclusive: anything that changes a hunt
+#define LOCK_CACHE_SIZE 16          // Hunt lock files kept open at once
+
+#define JOURNAL_MAGIC 0x4C4E4A54    // "TJNL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_OP_APPEND 1         // Records appended to treasures.dat from offset on
+#define JOURNAL_OP_REMOVE 2         // The record at offset marked as removed
+
+// Intent written to hunts/<id>/journal by hunts in journaled mode before
+// treasures.dat is touched, and truncated away once the change and the
+// meta block describing it are on disk. A journal still holding a valid
+// intent when the hunt is next locked belongs to an operation that never
+// finished: unless the meta block has moved past generation (the
+// operation completed and only the truncation was lost), the change is
+// rolled back and the derived files are rebuilt.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t op;                   // JOURNAL_OP_*
+    int32_t treasure_id;           // Removed ID, or the first appended one
+    int64_t offset;
+    uint64_t generation;           // Meta generation before the operation
+    uint32_t format;               // Treasure file format
+    uint32_t checksum;             // FNV-1a of the entry with this field zero
+} JournalEntry;
+
+// Function prototypes
+char* get_lock_file_path(const char *hunt_id);
+char* get_journal_path(const char *hunt_id);
+int lock_hunt(const char *hunt_id, int mode);
+void unlock_hunt(const char *hunt_id);
+int hunt_locked_for_write(const char *hunt_id);
+int journal_begin(const char *hunt_id, int op, int treasure_id, int format, off_t offset);
+int journal_commit(const char *hunt_id, int data_fd);
+int journal_recover(const char *hunt_id);
+void set_journaled(const char *hunt_id, int enable);
+
+#endif
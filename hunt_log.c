@@ -0,0 +1,783 @@
+#define _DEFAULT_SOURCE  // clock_gettime, fdatasync, getline
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "outbuf.h"
+#include "treasure_store.h"
+#include "hunt_log.h"
+#include "hunt_journal.h"
+
+#define LOG_DETAIL_MAX 1024         // Longest detail text kept in a binary record
+
+static HuntLog log_cache[LOG_CACHE_SIZE];
+static int log_cache_ready = 0;     // Slots initialized and the exit flush registered
+static int log_cache_next = 0;      // Slot replaced by the next miss
+
+// Get the path to the binary operation log of a hunt
+char* get_oplog_path(const char *hunt_id) {
+    static char oplog_path[MAX_PATH];
+    
+    strcpy(oplog_path, HUNT_DIR_PREFIX);
+    strcat(oplog_path, hunt_id);
+    strcat(oplog_path, "/oplog.bin");
+    
+    return oplog_path;
+}
+
+// Get the path to the sparse timestamp index of the binary operation log
+char* get_oplog_index_path(const char *hunt_id) {
+    static char index_path[MAX_PATH];
+    
+    strcpy(index_path, HUNT_DIR_PREFIX);
+    strcat(index_path, hunt_id);
+    strcat(index_path, "/oplog.idx");
+    
+    return index_path;
+}
+
+static long long monotonic_ms(void) {
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Open a hunt's text log for appending, creating the logged_hunt-<id>
+// link along with the file. Returns the descriptor, or -1 on error.
+static int open_text_log(const char *hunt_id) {
+    char *log_path = get_log_file_path(hunt_id);
+    int fd = open(log_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    
+    if (fd == -1 && errno == ENOENT) {
+        fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd != -1) {
+            create_symlink(hunt_id);
+        } else if (errno == EEXIST) {
+            fd = open(log_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+        }
+    }
+    if (fd == -1) {
+        perror("Failed to open log file");
+    }
+    
+    return fd;
+}
+
+// Open a hunt's binary log for appending. A new file is written with its
+// header under a temporary name and linked into place, so concurrent
+// writers never see (or append to) a file without a header. Returns the
+// descriptor, or -1 on error.
+static int open_binary_log(const char *hunt_id) {
+    char oplog_path[MAX_PATH];
+    char temp_path[MAX_PATH + 16];
+    OpLogHeader header = { OPLOG_MAGIC, OPLOG_VERSION };
+    int fd;
+    
+    strcpy(oplog_path, get_oplog_path(hunt_id));
+    fd = open(oplog_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    
+    if (fd == -1 && errno == ENOENT) {
+        snprintf(temp_path, sizeof(temp_path), "%s.%d", oplog_path, (int)getpid());
+        fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            perror("Failed to create operation log");
+            return -1;
+        }
+        if (write(fd, &header, sizeof(header)) != sizeof(header) ||
+            (link(temp_path, oplog_path) == -1 && errno != EEXIST)) {
+            perror("Failed to create operation log");
+            close(fd);
+            unlink(temp_path);
+            return -1;
+        }
+        close(fd);
+        unlink(temp_path);
+        fd = open(oplog_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+    if (fd == -1) {
+        perror("Failed to open operation log");
+    }
+    
+    return fd;
+}
+
+// Read a hunt's log settings from its meta block into an appender: the
+// sync policy is applied right away, and the log format it asks for (1
+// for binary) is returned. Another process may change them while the log
+// is open; the block is replaced on every change, so it is only read
+// again when its inode differs.
+static int log_read_settings(HuntLog *log, const char *hunt_id) {
+    struct stat file_stat;
+    HuntMeta meta;
+    
+    if (stat(get_meta_file_path(hunt_id), &file_stat) == -1) {
+        file_stat.st_dev = 0;
+        file_stat.st_ino = 0;
+    }
+    if (file_stat.st_dev == log->meta_dev && file_stat.st_ino == log->meta_ino) {
+        return log->binary;
+    }
+    log->meta_dev = file_stat.st_dev;
+    log->meta_ino = file_stat.st_ino;
+    
+    if (read_hunt_meta(hunt_id, &meta) == -1) {
+        return 0;
+    }
+    log->sync_policy = (meta.flags & META_LOG_SYNC_MASK) >> META_LOG_SYNC_SHIFT;
+    return (meta.flags & META_LOG_BINARY) != 0;
+}
+
+// Get the appender of a hunt, opening the log in the next free (or least
+// recently opened) slot. Returns NULL on error.
+static HuntLog* log_get(const char *hunt_id) {
+    HuntLog *log = NULL;
+    int binary;
+    
+    if (!log_cache_ready) {
+        for (int i = 0; i < LOG_CACHE_SIZE; i++) {
+            log_cache[i].fd = -1;
+            log_cache[i].index_fd = -1;
+        }
+        atexit(log_flush_all);
+        log_cache_ready = 1;
+    }
+    
+    for (int i = 0; i < LOG_CACHE_SIZE; i++) {
+        if (log_cache[i].fd != -1 && strcmp(log_cache[i].hunt_id, hunt_id) == 0) {
+            log = &log_cache[i];
+            break;
+        }
+    }
+    
+    if (log) {
+        binary = log_read_settings(log, hunt_id);
+        if (binary == log->binary) {
+            return log;
+        }
+        
+        // Switched to the other log file: write out what was queued in the
+        // old format, then continue in the new file
+        log_close_hunt(hunt_id);
+    } else {
+        log = &log_cache[log_cache_next];
+        log_cache_next = (log_cache_next + 1) % LOG_CACHE_SIZE;
+        if (log->fd != -1) {
+            log_close_hunt(log->hunt_id);
+        }
+        
+        log->sync_policy = LOG_SYNC_NONE;
+        log->binary = 0;
+        log->meta_dev = 0;
+        log->meta_ino = 0;
+        binary = log_read_settings(log, hunt_id);
+    }
+    
+    log->binary = binary;
+    log->fd = binary ? open_binary_log(hunt_id) : open_text_log(hunt_id);
+    if (log->fd == -1) {
+        return NULL;
+    }
+    
+    strncpy(log->hunt_id, hunt_id, MAX_PATH - 1);
+    log->hunt_id[MAX_PATH - 1] = '\0';
+    log->index_fd = -1;
+    log->len = 0;
+    
+    return log;
+}
+
+// Add sparse index entries for the binary records just written at start:
+// one for each record that spans a multiple of OPLOG_INDEX_STRIDE
+static void index_written_records(HuntLog *log, off_t start, size_t len) {
+    OpLogIndexEntry entries[LOG_BUFFER_SIZE / OPLOG_INDEX_STRIDE + 2];
+    size_t count = 0;
+    size_t pos = 0;
+    OpLogRecord record;
+    
+    while (pos + sizeof(OpLogRecord) <= len) {
+        off_t offset = start + pos;
+        off_t boundary = (offset + OPLOG_INDEX_STRIDE - 1) / OPLOG_INDEX_STRIDE * OPLOG_INDEX_STRIDE;
+        
+        memcpy(&record, log->buffer + pos, sizeof(record));
+        pos += OPLOG_RECORD_SIZE(record.detail_len);
+        
+        if (boundary < start + (off_t)pos && count < sizeof(entries) / sizeof(entries[0])) {
+            entries[count].timestamp = record.timestamp;
+            entries[count].offset = offset;
+            count++;
+        }
+    }
+    
+    if (count == 0) {
+        return;
+    }
+    
+    if (log->index_fd == -1) {
+        log->index_fd = open(get_oplog_index_path(log->hunt_id), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (log->index_fd == -1) {
+            perror("Failed to open operation log index");
+            return;
+        }
+    }
+    if (write(log->index_fd, entries, count * sizeof(OpLogIndexEntry)) == -1) {
+        perror("Failed to write operation log index");
+    }
+}
+
+// Write out everything buffered for a hunt, then sync it if the hunt asks
+// for it. Returns 0 on success, -1 on error (the entries are dropped).
+int log_flush(HuntLog *log) {
+    struct stat file_stat;
+    size_t done = 0;
+    int status = 0;
+    
+    if (log->fd == -1 || log->len == 0) {
+        return 0;
+    }
+    
+    // The log was deleted under us (the hunt was removed and perhaps
+    // created again): continue in the file now at the path
+    if (fstat(log->fd, &file_stat) == 0 && file_stat.st_nlink == 0) {
+        int fd = log->binary ? open_binary_log(log->hunt_id) : open_text_log(log->hunt_id);
+        if (fd == -1) {
+            log->len = 0;
+            return -1;
+        }
+        close(log->fd);
+        log->fd = fd;
+        if (log->index_fd != -1) {
+            close(log->index_fd);
+            log->index_fd = -1;
+        }
+    }
+    
+    while (done < log->len) {
+        ssize_t written = write(log->fd, log->buffer + done, log->len - done);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to write to log file");
+            status = -1;
+            break;
+        }
+        
+        // O_APPEND leaves the offset at the end of what this write added,
+        // which places the records it carried
+        if (log->binary && done == 0) {
+            off_t end = lseek(log->fd, 0, SEEK_CUR);
+            if (end != -1) {
+                index_written_records(log, end - written, written);
+            }
+        }
+        done += written;
+    }
+    
+    if (status == 0 && log->sync_policy != LOG_SYNC_NONE && fdatasync(log->fd) == -1) {
+        perror("Failed to sync log file");
+        status = -1;
+    }
+    
+    log->len = 0;
+    return status;
+}
+
+// Queue one entry (a complete line or binary record) in an appender.
+// Returns 0 on success, -1 on error.
+static int log_buffer(HuntLog *log, const char *entry, size_t len) {
+    long long now;
+    
+    if (len > LOG_BUFFER_SIZE - log->len && log_flush(log) == -1) {
+        return -1;
+    }
+    
+    now = monotonic_ms();
+    if (log->len == 0) {
+        log->first_pending_ms = now;
+    }
+    memcpy(log->buffer + log->len, entry, len);
+    log->len += len;
+    
+    if (log->sync_policy == LOG_SYNC_ALWAYS || now - log->first_pending_ms >= LOG_FLUSH_INTERVAL_MS) {
+        return log_flush(log);
+    }
+    
+    return 0;
+}
+
+// Format the text of an operation, as it appears in logged_hunt
+static void format_event(char *buffer, size_t size, const char *hunt_id, int op, int treasure_id,
+                         const char *username, long long amount, const char *detail) {
+    switch (op) {
+        case LOG_OP_ADD:
+            snprintf(buffer, size, "Added treasure ID %d by %s", treasure_id, username);
+            break;
+        case LOG_OP_IMPORT:
+            snprintf(buffer, size, "Imported %lld treasures (IDs %d-%lld)", amount, treasure_id,
+                     treasure_id + amount - 1);
+            break;
+        case LOG_OP_LIST:
+            snprintf(buffer, size, "Listed treasures for hunt '%s'", hunt_id);
+            break;
+        case LOG_OP_VIEW:
+            snprintf(buffer, size, "Viewed treasure ID %d from hunt '%s'", treasure_id, hunt_id);
+            break;
+        case LOG_OP_REMOVE:
+            snprintf(buffer, size, "Removed treasure ID %d from hunt '%s'", treasure_id, hunt_id);
+            break;
+        case LOG_OP_COMPACT:
+            snprintf(buffer, size, "Compacted hunt '%s' (reclaimed %lld bytes)", hunt_id, amount);
+            break;
+        case LOG_OP_REMOVE_HUNT:
+            snprintf(buffer, size, "Removing hunt '%s'", hunt_id);
+            break;
+        case LOG_OP_COLUMNAR:
+            snprintf(buffer, size, "Converted hunt '%s' to columns (%lld rows)", hunt_id, amount);
+            break;
+        case LOG_OP_SEARCH:
+            snprintf(buffer, size, "Searched hunt '%s' %s", hunt_id, detail);
+            break;
+        default:
+            snprintf(buffer, size, "%s", detail);
+            break;
+    }
+}
+
+// Log an operation: as a text line in logged_hunt, or as a record in
+// oplog.bin for hunts with a binary log. username and detail may be NULL.
+// Returns 0 on success, -1 on error.
+int log_event(const char *hunt_id, int op, int treasure_id, const char *username, long long amount,
+              const char *detail) {
+    HuntLog *log = log_get(hunt_id);
+    char entry[OPLOG_RECORD_SIZE(LOG_DETAIL_MAX) + MAX_PATH];
+    time_t now = time(NULL);
+    
+    if (!log) {
+        return -1;
+    }
+    
+    if (!log->binary) {
+        char time_str[30];
+        char message[512];
+        
+        format_time(now, time_str);
+        format_event(message, sizeof(message), hunt_id, op, treasure_id, username ? username : "",
+                     amount, detail ? detail : "");
+        snprintf(entry, sizeof(entry), "[%s] %s\n", time_str, message);
+        return log_buffer(log, entry, strlen(entry));
+    }
+    
+    OpLogRecord record;
+    size_t detail_len = detail ? strnlen(detail, LOG_DETAIL_MAX) : 0;
+    size_t record_len = OPLOG_RECORD_SIZE(detail_len);
+    
+    memset(&record, 0, sizeof(record));
+    record.timestamp = now;
+    record.amount = amount;
+    record.treasure_id = treasure_id;
+    record.user_id = SCAN_NO_USER_ID;
+    record.op = (uint16_t)op;
+    record.detail_len = (uint16_t)detail_len;
+    
+    // Only writers may add names: a reader logs an unknown user without one
+    if (username) {
+        UserDict *dict = user_dict_get(hunt_id);
+        int status = -1;
+        
+        if (dict) {
+            status = hunt_locked_for_write(hunt_id) ? user_dict_intern(dict, username, &record.user_id) :
+                                                      user_dict_find(dict, username, &record.user_id);
+        }
+        if (status == -1) {
+            record.user_id = SCAN_NO_USER_ID;
+        }
+    }
+    
+    memset(entry, 0, record_len);
+    memcpy(entry, &record, sizeof(record));
+    if (detail_len) {
+        memcpy(entry + sizeof(record), detail, detail_len);
+    }
+    
+    return log_buffer(log, entry, record_len);
+}
+
+// Flush the buffers of every open hunt log
+void log_flush_all(void) {
+    for (int i = 0; log_cache_ready && i < LOG_CACHE_SIZE; i++) {
+        log_flush(&log_cache[i]);
+    }
+}
+
+// Flush the hunt logs whose oldest entry has waited long enough
+void log_flush_due(void) {
+    long long now = monotonic_ms();
+    
+    for (int i = 0; log_cache_ready && i < LOG_CACHE_SIZE; i++) {
+        if (log_cache[i].len > 0 && now - log_cache[i].first_pending_ms >= LOG_FLUSH_INTERVAL_MS) {
+            log_flush(&log_cache[i]);
+        }
+    }
+}
+
+// Milliseconds until log_flush_due() has work, or -1 if nothing is
+// buffered (suitable as a poll()/epoll_wait() timeout)
+int log_next_flush_ms(void) {
+    long long now = monotonic_ms();
+    long long next = -1;
+    
+    for (int i = 0; log_cache_ready && i < LOG_CACHE_SIZE; i++) {
+        if (log_cache[i].len > 0) {
+            long long wait = log_cache[i].first_pending_ms + LOG_FLUSH_INTERVAL_MS - now;
+            if (wait < 0) {
+                wait = 0;
+            }
+            if (next == -1 || wait < next) {
+                next = wait;
+            }
+        }
+    }
+    
+    return (int)next;
+}
+
+// Flush and close a hunt's log, e.g. before the file is deleted
+void log_close_hunt(const char *hunt_id) {
+    for (int i = 0; log_cache_ready && i < LOG_CACHE_SIZE; i++) {
+        if (log_cache[i].fd != -1 && strcmp(log_cache[i].hunt_id, hunt_id) == 0) {
+            log_flush(&log_cache[i]);
+            close(log_cache[i].fd);
+            log_cache[i].fd = -1;
+            if (log_cache[i].index_fd != -1) {
+                close(log_cache[i].index_fd);
+                log_cache[i].index_fd = -1;
+            }
+        }
+    }
+}
+
+// Load the meta block of an existing hunt for one of the log settings.
+// Returns 0 on success, -1 if the hunt has no treasures or on error.
+static int load_log_settings(const char *hunt_id, HuntMeta *meta) {
+    struct stat file_stat;
+    
+    if (stat(get_treasure_file_path(hunt_id), &file_stat) == -1) {
+        printf("Hunt '%s' has no treasures or does not exist.\n", hunt_id);
+        return -1;
+    }
+    
+    return load_hunt_meta(hunt_id, meta, file_stat.st_size);
+}
+
+// Set when a hunt's log entries are synced to disk: "none", "batch"
+// (after every flush) or "always" (every entry)
+void set_log_sync(const char *hunt_id, const char *policy) {
+    static const char *names[] = { "none", "batch", "always" };
+    HuntMeta meta;
+    int sync_policy = -1;
+    
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(policy, names[i]) == 0) {
+            sync_policy = i;
+        }
+    }
+    if (sync_policy == -1) {
+        printf("Log sync policy must be none, batch or always.\n");
+        return;
+    }
+    
+    if (lock_hunt(hunt_id, HUNT_LOCK_WRITE) == -1) {
+        return;
+    }
+    if (load_log_settings(hunt_id, &meta) == -1) {
+        unlock_hunt(hunt_id);
+        return;
+    }
+    
+    meta.flags = (meta.flags & ~META_LOG_SYNC_MASK) | ((uint32_t)sync_policy << META_LOG_SYNC_SHIFT);
+    // Open appenders, in this process or others, pick the policy up from
+    // the new meta block with their next entry
+    if (write_hunt_meta(hunt_id, &meta) == 0) {
+        printf("Log sync policy of hunt '%s' set to %s.\n", hunt_id, names[sync_policy]);
+    }
+    
+    unlock_hunt(hunt_id);
+}
+
+// Choose whether a hunt logs to logged_hunt ("text") or oplog.bin
+// ("binary"). Entries already logged stay in the file they were written to.
+void set_log_format(const char *hunt_id, const char *format) {
+    HuntMeta meta;
+    int binary;
+    
+    if (strcmp(format, "text") == 0) {
+        binary = 0;
+    } else if (strcmp(format, "binary") == 0) {
+        binary = 1;
+    } else {
+        printf("Log format must be text or binary.\n");
+        return;
+    }
+    
+    if (lock_hunt(hunt_id, HUNT_LOCK_WRITE) == -1) {
+        return;
+    }
+    if (load_log_settings(hunt_id, &meta) == -1) {
+        unlock_hunt(hunt_id);
+        return;
+    }
+    
+    meta.flags = binary ? (meta.flags | META_LOG_BINARY) : (meta.flags & ~META_LOG_BINARY);
+    if (write_hunt_meta(hunt_id, &meta) == 0) {
+        log_close_hunt(hunt_id);
+        printf("Hunt '%s' now logs to %s.\n", hunt_id,
+               binary ? get_oplog_path(hunt_id) : get_log_file_path(hunt_id));
+    }
+    
+    unlock_hunt(hunt_id);
+}
+
+// Parse a time given as seconds since the epoch or as local time in the
+// log's format ("YYYY-MM-DD HH:MM:SS", or just the date). Returns 0 on
+// success, -1 if the text is not a time.
+int parse_log_time(const char *text, time_t *result) {
+    struct tm time_info;
+    char *end;
+    long long seconds = strtoll(text, &end, 10);
+    int fields;
+    
+    if (*text != '\0' && *end == '\0') {
+        *result = (time_t)seconds;
+        return 0;
+    }
+    
+    memset(&time_info, 0, sizeof(time_info));
+    fields = sscanf(text, "%d-%d-%d%*c%d:%d:%d", &time_info.tm_year, &time_info.tm_mon,
+                    &time_info.tm_mday, &time_info.tm_hour, &time_info.tm_min, &time_info.tm_sec);
+    if (fields != 3 && fields < 5) {
+        return -1;
+    }
+    
+    time_info.tm_year -= 1900;
+    time_info.tm_mon -= 1;
+    time_info.tm_isdst = -1;
+    *result = mktime(&time_info);
+    return *result == (time_t)-1 ? -1 : 0;
+}
+
+// Print the lines of logged_hunt stamped between since and until. Text
+// timestamps sort as strings, so each line is compared as it is read.
+static int query_text_log(const char *hunt_id, time_t since, time_t until, OutBuf *out) {
+    char since_str[30], until_str[30];
+    FILE *file = fopen(get_log_file_path(hunt_id), "r");
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    
+    if (!file) {
+        if (errno != ENOENT) {
+            perror("Failed to open log file");
+            return -1;
+        }
+        return 0;
+    }
+    
+    format_time(since, since_str);
+    format_time(until, until_str);
+    
+    while ((len = getline(&line, &line_size, file)) != -1) {
+        if (len > 21 && line[0] == '[' && strncmp(line + 1, since_str, 19) >= 0 &&
+            strncmp(line + 1, until_str, 19) <= 0) {
+            outbuf_write(out, line, len);
+        }
+    }
+    
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+static int compare_index_offsets(const void *a, const void *b) {
+    const OpLogIndexEntry *x = a;
+    const OpLogIndexEntry *y = b;
+    
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+// Find where to start reading oplog.bin for entries from since on: the
+// last indexed record stamped well before since. Returns the offset.
+static off_t find_oplog_start(const char *hunt_id, time_t since, off_t file_size) {
+    off_t start = sizeof(OpLogHeader);
+    OpLogIndexEntry *entries;
+    struct stat file_stat;
+    size_t count = 0, lo = 0, hi;
+    int fd = open(get_oplog_index_path(hunt_id), O_RDONLY);
+    
+    if (fd == -1) {
+        return start;
+    }
+    if (fstat(fd, &file_stat) == -1 || file_stat.st_size < (off_t)sizeof(OpLogIndexEntry)) {
+        close(fd);
+        return start;
+    }
+    
+    entries = malloc(file_stat.st_size);
+    if (!entries || pread(fd, entries, file_stat.st_size, 0) != file_stat.st_size) {
+        free(entries);
+        close(fd);
+        return start;
+    }
+    close(fd);
+    
+    // Drop entries past the end of the log (it was replaced) and put the
+    // rest in file order
+    for (size_t i = 0; i < file_stat.st_size / sizeof(OpLogIndexEntry); i++) {
+        if (entries[i].offset >= start && entries[i].offset < file_size) {
+            entries[count++] = entries[i];
+        }
+    }
+    qsort(entries, count, sizeof(OpLogIndexEntry), compare_index_offsets);
+    
+    // Timestamps grow with the offset, give or take LOG_ORDER_SLACK
+    hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].timestamp < since - LOG_ORDER_SLACK) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0) {
+        start = entries[lo - 1].offset;
+    }
+    
+    free(entries);
+    return start;
+}
+
+// Print the records of oplog.bin stamped between since and until as log
+// lines, reading from the sparse index's starting point until the records
+// are past until
+static int query_binary_log(const char *hunt_id, time_t since, time_t until, OutBuf *out) {
+    struct stat file_stat;
+    OpLogHeader header;
+    OpLogRecord record;
+    UserDict *dict = NULL;
+    char detail[LOG_DETAIL_MAX + 1];
+    char message[512];
+    char time_str[32] = "[";
+    int64_t time_stamp = -1;        // Time formatted in time_str
+    off_t start, map_start;
+    size_t map_len, pos;
+    char *map;
+    int fd = open(get_oplog_path(hunt_id), O_RDONLY);
+    
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            perror("Failed to open operation log");
+            return -1;
+        }
+        return 0;
+    }
+    
+    if (fstat(fd, &file_stat) == -1 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != OPLOG_MAGIC || header.version != OPLOG_VERSION) {
+        fprintf(stderr, "Invalid operation log for hunt '%s'\n", hunt_id);
+        close(fd);
+        return -1;
+    }
+    
+    start = find_oplog_start(hunt_id, since, file_stat.st_size);
+    map_start = start & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+    map_len = file_stat.st_size - map_start;
+    if (map_len == 0) {
+        close(fd);
+        return 0;
+    }
+    
+    map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_start);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map operation log");
+        return -1;
+    }
+    madvise(map, map_len, MADV_SEQUENTIAL);
+    
+    pos = start - map_start;
+    while (pos + sizeof(OpLogRecord) <= map_len) {
+        const char *username = NULL;
+        
+        memcpy(&record, map + pos, sizeof(record));
+        if (pos + OPLOG_RECORD_SIZE(record.detail_len) > map_len || record.detail_len > LOG_DETAIL_MAX) {
+            break;
+        }
+        if (record.timestamp > until + LOG_ORDER_SLACK) {
+            break;
+        }
+        
+        if (record.timestamp >= since && record.timestamp <= until) {
+            memcpy(detail, map + pos + sizeof(record), record.detail_len);
+            detail[record.detail_len] = '\0';
+            
+            if (record.user_id != SCAN_NO_USER_ID) {
+                if (!dict) {
+                    dict = user_dict_get(hunt_id);
+                }
+                username = dict ? user_dict_name(dict, record.user_id) : NULL;
+            }
+            
+            // Neighbouring records mostly share their second
+            if (record.timestamp != time_stamp) {
+                format_time(record.timestamp, time_str + 1);
+                strcat(time_str, "] ");
+                time_stamp = record.timestamp;
+            }
+            format_event(message, sizeof(message) - 1, hunt_id, record.op, record.treasure_id,
+                         username ? username : "?", record.amount, detail);
+            strcat(message, "\n");
+            outbuf_write(out, time_str, strlen(time_str));
+            outbuf_write(out, message, strlen(message));
+        }
+        
+        pos += OPLOG_RECORD_SIZE(record.detail_len);
+    }
+    
+    munmap(map, map_len);
+    return 0;
+}
+
+// Print a hunt's log entries stamped between since and until (inclusive)
+// in the text log's format, from whichever log the hunt writes. Returns 0
+// on success, -1 on error.
+int query_log(const char *hunt_id, time_t since, time_t until) {
+    HuntMeta meta;
+    OutBuf out;
+    int status;
+    
+    // Make this process's own buffered entries visible first
+    for (int i = 0; log_cache_ready && i < LOG_CACHE_SIZE; i++) {
+        if (log_cache[i].fd != -1 && strcmp(log_cache[i].hunt_id, hunt_id) == 0) {
+            log_flush(&log_cache[i]);
+        }
+    }
+    
+    outbuf_init(&out, STDOUT_FILENO);
+    if (read_hunt_meta(hunt_id, &meta) == 0 && (meta.flags & META_LOG_BINARY)) {
+        status = query_binary_log(hunt_id, since, until, &out);
+    } else {
+        status = query_text_log(hunt_id, since, until, &out);
+    }
+    outbuf_flush(&out);
+    
+    return status;
+}
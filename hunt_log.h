@@ -0,0 +1,100 @@
+#ifndef HUNT_LOG_H
+#define HUNT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "treasure_store.h"
+
+#define LOG_BUFFER_SIZE 16384       // Bytes of entries batched into one write()
+#define LOG_FLUSH_INTERVAL_MS 1000  // Longest an entry waits in the buffer
+#define LOG_CACHE_SIZE 16           // Hunt logs kept open at once
+
+// When appended entries reach the disk, kept per hunt in the meta flags
+#define LOG_SYNC_NONE 0             // Leave flushed entries to the page cache
+#define LOG_SYNC_BATCH 1            // fdatasync() after every flush
+#define LOG_SYNC_ALWAYS 2           // Flush and fdatasync() every entry
+
+#define OPLOG_MAGIC 0x4C504F54      // "TOPL"
+#define OPLOG_VERSION 1
+#define OPLOG_INDEX_STRIDE 65536    // Bytes of oplog.bin per sparse index entry
+#define LOG_ORDER_SLACK 5           // Seconds entries of concurrent writers may be out of order
+#define LOG_TIME_MAX 253402300799LL // 9999-12-31 23:59:59 UTC, the open end of a log query
+
+// Logged operations (OpLogRecord.op)
+#define LOG_OP_ADD 1                // treasure_id, user
+#define LOG_OP_IMPORT 2             // First ID in treasure_id, count in amount
+#define LOG_OP_LIST 3
+#define LOG_OP_VIEW 4               // treasure_id, user
+#define LOG_OP_REMOVE 5             // treasure_id, user
+#define LOG_OP_COMPACT 6            // Bytes reclaimed in amount
+#define LOG_OP_REMOVE_HUNT 7
+#define LOG_OP_COLUMNAR 8           // Rows in amount
+#define LOG_OP_SEARCH 9             // Search area in the detail text
+#define LOG_OP_MESSAGE 10           // Free-form message in the detail text
+
+// Header of the optional binary operation log (hunts/<id>/oplog.bin),
+// used instead of logged_hunt when the hunt's meta flags ask for it. It is
+// followed by one OpLogRecord per operation, each followed by detail_len
+// bytes of detail text and padded to a multiple of 4 bytes.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} OpLogHeader;
+
+typedef struct {
+    int64_t timestamp;             // Seconds since the epoch
+    int64_t amount;                // Count or size, depending on the operation
+    int32_t treasure_id;           // 0 if the operation has none
+    uint32_t user_id;              // Owner in the user dictionary, or SCAN_NO_USER_ID
+    uint16_t op;                   // LOG_OP_*
+    uint16_t detail_len;
+    uint32_t reserved;
+} OpLogRecord;
+
+#define OPLOG_RECORD_SIZE(detail_len) ((sizeof(OpLogRecord) + (detail_len) + 3) & ~(size_t)3)
+
+// Sparse timestamp index of oplog.bin (hunts/<id>/oplog.idx): the record
+// that spans each multiple of OPLOG_INDEX_STRIDE in the log gets an entry.
+// Concurrent writers may append entries slightly out of order, and an
+// entry lost in a crash only makes queries read further.
+typedef struct {
+    int64_t timestamp;
+    int64_t offset;
+} OpLogIndexEntry;
+
+// Open appender of a hunt's log (logged_hunt or oplog.bin). Entries are
+// collected in the buffer and written together when it fills up, when the
+// oldest one has waited LOG_FLUSH_INTERVAL_MS, or when the process exits,
+// each flush being a single O_APPEND write() of whole lines.
+typedef struct {
+    char hunt_id[MAX_PATH];
+    int fd;                        // -1 while the slot is unused
+    int binary;                    // Appending OpLogRecords to oplog.bin
+    int index_fd;                  // oplog.idx, -1 until the first index entry
+    int sync_policy;               // LOG_SYNC_*
+    dev_t meta_dev;                // Meta block the settings were read from;
+    ino_t meta_ino;                // it is replaced whenever they change
+    long long first_pending_ms;    // Monotonic time of the oldest buffered entry
+    size_t len;                    // Bytes buffered
+    char buffer[LOG_BUFFER_SIZE];
+} HuntLog;
+
+// Function prototypes
+char* get_oplog_path(const char *hunt_id);
+char* get_oplog_index_path(const char *hunt_id);
+int log_event(const char *hunt_id, int op, int treasure_id, const char *username, long long amount,
+              const char *detail);
+int log_flush(HuntLog *log);
+void log_flush_all(void);
+void log_flush_due(void);
+int log_next_flush_ms(void);
+void log_close_hunt(const char *hunt_id);
+void set_log_sync(const char *hunt_id, const char *policy);
+void set_log_format(const char *hunt_id, const char *format);
+int parse_log_time(const char *text, time_t *result);
+int query_log(const char *hunt_id, time_t since, time_t until);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef MONITOR_PROTOCOL_H
+#define MONITOR_PROTOCOL_H
+
+#include <stdint.h>
+
+// Binary protocol between treasure_hub and treasure_monitor. The hub
+// writes requests to one pipe and the monitor answers on another. Every
+// frame starts with a fixed header followed by 'length' payload bytes.
+// Request IDs let several requests be in flight at once; the monitor
+// answers them in order, tagging each response frame with the ID.
+
+#define MONITOR_MAX_PAYLOAD 4096   // Largest request payload accepted
+#define MONITOR_MAX_DATA 65536     // Largest DATA frame payload sent
+
+// Request commands
+#define MONITOR_CMD_LIST_HUNTS     1
+#define MONITOR_CMD_LIST_TREASURES 2   // Payload: hunt_id
+#define MONITOR_CMD_VIEW_TREASURE  3   // Payload: hunt_id '\0' treasure_id
+#define MONITOR_CMD_STOP           4
+
+// Response frame types
+#define MONITOR_RESPONSE_DATA 1   // Part of the response text
+#define MONITOR_RESPONSE_END  2   // Last frame of a response, no payload
+
+// Response status (carried by the END frame)
+#define MONITOR_STATUS_OK    0
+#define MONITOR_STATUS_ERROR 1
+
+typedef struct {
+    uint32_t request_id;
+    uint16_t command;
+    uint16_t reserved;
+    uint32_t length;               // Payload bytes that follow
+} MonitorRequestHeader;
+
+typedef struct {
+    uint32_t request_id;
+    uint16_t type;
+    uint16_t status;
+    uint32_t length;               // Payload bytes that follow
+} MonitorResponseHeader;
+
+#endif
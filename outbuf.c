@@ -0,0 +1,147 @@
+#define _DEFAULT_SOURCE  // vsnprintf, writev
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "outbuf.h"
+
+// Sink for buffers that write to standard output
+static OutSink stdout_sink = NULL;
+static void *stdout_sink_context = NULL;
+
+int outbuf_writev_all(int fd, struct iovec *iov, int iov_count) {
+    while (iov_count > 0) {
+        ssize_t written = writev(fd, iov, iov_count);
+        
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        
+        // Skip the iovecs that were written completely
+        while (iov_count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    
+    return 0;
+}
+
+// Hand iovecs to the buffer's sink or write them to its fd
+static int emit(OutBuf *out, struct iovec *iov, int iov_count) {
+    if (out->sink) {
+        return out->sink(out->sink_context, iov, iov_count);
+    }
+    return outbuf_writev_all(out->fd, iov, iov_count);
+}
+
+void outbuf_init(OutBuf *out, int fd) {
+    // Keep ordering with anything already printed through stdio
+    fflush(stdout);
+    
+    out->fd = fd;
+    out->len = 0;
+    out->sink = (fd == STDOUT_FILENO) ? stdout_sink : NULL;
+    out->sink_context = (fd == STDOUT_FILENO) ? stdout_sink_context : NULL;
+}
+
+void outbuf_set_stdout_sink(OutSink sink, void *context) {
+    stdout_sink = sink;
+    stdout_sink_context = context;
+}
+
+void outbuf_printf(OutBuf *out, const char *format, ...) {
+    va_list args;
+    int needed;
+    
+    va_start(args, format);
+    needed = vsnprintf(out->data + out->len, OUTBUF_SIZE - out->len, format, args);
+    va_end(args);
+    
+    if (needed < 0) {
+        return;
+    }
+    
+    if ((size_t)needed < OUTBUF_SIZE - out->len) {
+        out->len += needed;
+        return;
+    }
+    
+    // Did not fit: flush and format again into the empty buffer
+    outbuf_flush(out);
+    
+    if ((size_t)needed < OUTBUF_SIZE) {
+        va_start(args, format);
+        vsnprintf(out->data, OUTBUF_SIZE, format, args);
+        va_end(args);
+        out->len = needed;
+    } else {
+        // Longer than the whole buffer: format it on its own
+        char *text = malloc(needed + 1);
+        
+        if (!text) {
+            perror("Failed to allocate output");
+            return;
+        }
+        
+        va_start(args, format);
+        vsnprintf(text, needed + 1, format, args);
+        va_end(args);
+        outbuf_write(out, text, needed);
+        free(text);
+    }
+}
+
+void outbuf_write(OutBuf *out, const void *data, size_t len) {
+    struct iovec iov[2];
+    
+    if (len < OUTBUF_SIZE - out->len) {
+        memcpy(out->data + out->len, data, len);
+        out->len += len;
+        return;
+    }
+    
+    // Write the buffered bytes and the new block in one call
+    iov[0].iov_base = out->data;
+    iov[0].iov_len = out->len;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
+    
+    if (emit(out, iov, 2) == -1) {
+        perror("Failed to write output");
+    }
+    out->len = 0;
+}
+
+int outbuf_flush(OutBuf *out) {
+    struct iovec iov;
+    int result = 0;
+    
+    if (out->len == 0) {
+        return 0;
+    }
+    
+    iov.iov_base = out->data;
+    iov.iov_len = out->len;
+    
+    if (emit(out, &iov, 1) == -1) {
+        perror("Failed to write output");
+        result = -1;
+    }
+    out->len = 0;
+    
+    return result;
+}
@@ -0,0 +1,46 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define OUTBUF_SIZE 65536  // Bytes buffered before a flush
+
+// Receives flushed output instead of the file descriptor. Returns 0 on
+// success, -1 on error.
+typedef int (*OutSink)(void *context, const struct iovec *iov, int iov_count);
+
+// Output buffer that collects formatted text and writes it to a file
+// descriptor in large chunks, so a long listing costs a handful of
+// write()/writev() calls instead of one per line.
+typedef struct {
+    int fd;                        // Destination file descriptor
+    OutSink sink;                  // Replaces writes to fd when set
+    void *sink_context;
+    size_t len;                    // Bytes currently buffered
+    char data[OUTBUF_SIZE];
+} OutBuf;
+
+// Start buffering output for fd (pending stdio output is flushed first)
+void outbuf_init(OutBuf *out, int fd);
+
+// Route the output of buffers later initialized on STDOUT_FILENO to sink
+// (NULL restores plain writes). Lets a server capture what library code
+// prints, e.g. to frame it for a client.
+void outbuf_set_stdout_sink(OutSink sink, void *context);
+
+// Append formatted text, flushing when the buffer fills up
+void outbuf_printf(OutBuf *out, const char *format, ...);
+
+// Append raw bytes; large blocks are written together with the buffer
+// in a single writev()
+void outbuf_write(OutBuf *out, const void *data, size_t len);
+
+// Write everything buffered. Returns 0 on success, -1 on error.
+int outbuf_flush(OutBuf *out);
+
+// Write all iovecs to fd, retrying on partial writes and interrupts (the
+// iovecs are modified). Returns 0 on success, -1 on error.
+int outbuf_writev_all(int fd, struct iovec *iov, int iov_count);
+
+#endif
@@ -3,28 +3,141 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "outbuf.h"
+#include "score_table.h"
+#include "treasure_store.h"
+
 #define MAX_LINE 1024
-#define MAX_USERS 100
-#define MAX_ITEMS 100
+#define SCORE_READ_ENTRIES 256  // Score file entries per read()
 
+// The K best users seen so far, kept as a min-heap on score so the
+// weakest of them is at the root and can be replaced in O(log K)
 typedef struct {
-    char name[128];
-    int value;
-    char owner[128];
-} Item;
+    ScoreEntry *entries;
+    size_t count;
+    size_t k;
+} TopScores;
 
-typedef struct {
-    char name[128];
-    int score;
-} User;
+static void print_scores(const ScoreTable *table) {
+    size_t shown = 0;
+    
+    printf("===== USER SCORES =====\n");
+    for (size_t i = 0; i < table->user_count; i++) {
+        // Users whose treasures were all removed have nothing to show
+        if (table->users[i].count <= 0) {
+            continue;
+        }
+        printf("%s: %lld points\n", table->users[i].name, table->users[i].score);
+        shown++;
+    }
+    
+    // If no users found
+    if (shown == 0) {
+        printf("No users with items found in this hunt.\n");
+    }
+}
+
+// Whether a ranks below b: lower score, ties broken by name
+static int ranks_below(const ScoreEntry *a, const ScoreEntry *b) {
+    if (a->score != b->score) {
+        return a->score < b->score;
+    }
+    return strcmp(a->username, b->username) > 0;
+}
+
+static int top_scores_init(TopScores *top, size_t k) {
+    top->entries = malloc(k * sizeof(ScoreEntry));
+    top->count = 0;
+    top->k = k;
+    return top->entries ? 0 : -1;
+}
+
+static void swap_entries(ScoreEntry *a, ScoreEntry *b) {
+    ScoreEntry temp = *a;
+    *a = *b;
+    *b = temp;
+}
 
-// Reads hunt data from stdin and calculates scores for each user
-void calculate_scores() {
+// Offer a user to the top K: O(log K), no memory beyond the K entries
+static void top_scores_offer(TopScores *top, const char *name, long long score) {
+    ScoreEntry entry;
+    size_t pos;
+    
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.username, name, MAX_USERNAME - 1);
+    entry.score = score;
+    
+    if (top->count < top->k) {
+        // Not full yet: append and sift up
+        pos = top->count++;
+        top->entries[pos] = entry;
+        while (pos > 0 && ranks_below(&top->entries[pos], &top->entries[(pos - 1) / 2])) {
+            swap_entries(&top->entries[pos], &top->entries[(pos - 1) / 2]);
+            pos = (pos - 1) / 2;
+        }
+        return;
+    }
+    
+    if (!ranks_below(&top->entries[0], &entry)) {
+        return;
+    }
+    
+    // Replace the weakest entry and sift down
+    top->entries[0] = entry;
+    pos = 0;
+    while (1) {
+        size_t child = 2 * pos + 1;
+        if (child >= top->count) {
+            break;
+        }
+        if (child + 1 < top->count && ranks_below(&top->entries[child + 1], &top->entries[child])) {
+            child++;
+        }
+        if (!ranks_below(&top->entries[child], &top->entries[pos])) {
+            break;
+        }
+        swap_entries(&top->entries[child], &top->entries[pos]);
+        pos = child;
+    }
+}
+
+static int compare_best_first(const void *a, const void *b) {
+    const ScoreEntry *x = a;
+    const ScoreEntry *y = b;
+    
+    if (ranks_below(x, y)) {
+        return 1;
+    }
+    return ranks_below(y, x) ? -1 : 0;
+}
+
+// Print the top K best first and release them
+static void print_top_scores(TopScores *top) {
+    qsort(top->entries, top->count, sizeof(ScoreEntry), compare_best_first);
+    
+    printf("===== TOP %zu USERS =====\n", top->k);
+    for (size_t i = 0; i < top->count; i++) {
+        printf("%zu. %s: %lld points\n", i + 1, top->entries[i].username,
+               (long long)top->entries[i].score);
+    }
+    
+    if (top->count == 0) {
+        printf("No users with items found in this hunt.\n");
+    }
+    
+    free(top->entries);
+}
+
+// Reads hunt data from stdin and calculates scores for each user in a
+// single pass. With top > 0 only the best 'top' users are printed.
+int calculate_scores(size_t top) {
     char line[MAX_LINE];
-    Item items[MAX_ITEMS];
-    User users[MAX_USERS];
-    int item_count = 0;
-    int user_count = 0;
+    ScoreTable table;
+    
+    if (score_table_init(&table) == -1) {
+        perror("Failed to allocate score table");
+        return -1;
+    }
     
     // Read items data from stdin
     while (fgets(line, MAX_LINE, stdin) != NULL) {
@@ -39,57 +152,153 @@ void calculate_scores() {
         // Parse item data (expected format: "name,value,owner")
         char *token = strtok(line, ",");
         if (token == NULL) continue;
-        strcpy(items[item_count].name, token);
         
         token = strtok(NULL, ",");
         if (token == NULL) continue;
-        items[item_count].value = atoi(token);
+        int value = atoi(token);
         
         token = strtok(NULL, ",");
         if (token == NULL) continue;
-        strcpy(items[item_count].owner, token);
         
-        // Record unique users
-        int user_exists = 0;
-        for (int i = 0; i < user_count; i++) {
-            if (strcmp(users[i].name, items[item_count].owner) == 0) {
-                user_exists = 1;
-                break;
-            }
+        if (strcmp(token, "none") == 0) {
+            continue;
         }
         
-        if (!user_exists && strcmp(items[item_count].owner, "none") != 0) {
-            strcpy(users[user_count].name, items[item_count].owner);
-            users[user_count].score = 0;
-            user_count++;
+        if (score_table_add(&table, token, value, 1) == -1) {
+            perror("Failed to allocate user");
+            score_table_free(&table);
+            return -1;
         }
-        
-        item_count++;
-        if (item_count >= MAX_ITEMS) break;
     }
     
-    // Calculate scores for each user
-    for (int i = 0; i < user_count; i++) {
-        for (int j = 0; j < item_count; j++) {
-            if (strcmp(items[j].owner, users[i].name) == 0) {
-                users[i].score += items[j].value;
+    if (top > 0) {
+        // Select from the totals with a size-K heap instead of sorting them
+        TopScores best;
+        if (top_scores_init(&best, top) == -1) {
+            perror("Failed to allocate top scores");
+            score_table_free(&table);
+            return -1;
+        }
+        for (size_t i = 0; i < table.user_count; i++) {
+            top_scores_offer(&best, table.users[i].name, table.users[i].score);
+        }
+        print_top_scores(&best);
+    } else {
+        print_scores(&table);
+    }
+    score_table_free(&table);
+    return 0;
+}
+
+// Streams the entries of a hunt's score file through a size-K heap, so
+// the top K cost O(K) memory however many users the hunt has
+int calculate_hunt_top_scores(const char *hunt_id, size_t top) {
+    ScoreEntry entries[SCORE_READ_ENTRIES];
+    char username[MAX_USERNAME + 1];
+    ScoresHeader header;
+    TopScores best;
+    ssize_t bytes_read;
+    int fd;
+    
+    if (top_scores_init(&best, top) == -1) {
+        perror("Failed to allocate top scores");
+        return -1;
+    }
+    
+    fd = open_hunt_scores(hunt_id, &header);
+    if (fd == -1) {
+        free(best.entries);
+        return -1;
+    }
+    
+    if (fd >= 0) {
+        while ((bytes_read = read(fd, entries, sizeof(entries))) > 0) {
+            size_t count = bytes_read / sizeof(ScoreEntry);
+            for (size_t i = 0; i < count; i++) {
+                memcpy(username, entries[i].username, MAX_USERNAME);
+                username[MAX_USERNAME] = '\0';
+                top_scores_offer(&best, username, entries[i].score);
             }
         }
+        close(fd);
     }
     
-    // Output scores
-    printf("===== USER SCORES =====\n");
-    for (int i = 0; i < user_count; i++) {
-        printf("%s: %d points\n", users[i].name, users[i].score);
+    print_top_scores(&best);
+    return 0;
+}
+
+// Copies the raw ScoreEntry records of a hunt's score file to stdout, so
+// the hub can merge per-hunt partial totals without parsing text
+int write_hunt_score_entries(const char *hunt_id) {
+    ScoreEntry entries[SCORE_READ_ENTRIES];
+    ScoresHeader header;
+    ssize_t bytes_read;
+    int fd;
+    
+    fd = open_hunt_scores(hunt_id, &header);
+    if (fd == -2) {
+        return 0;
+    }
+    if (fd == -1) {
+        return -1;
     }
     
-    // If no users found
-    if (user_count == 0) {
-        printf("No users with items found in this hunt.\n");
+    while ((bytes_read = read(fd, entries, sizeof(entries))) > 0) {
+        struct iovec iov;
+        iov.iov_base = entries;
+        iov.iov_len = bytes_read;
+        if (outbuf_writev_all(STDOUT_FILENO, &iov, 1) == -1) {
+            perror("Failed to write score entries");
+            close(fd);
+            return -1;
+        }
     }
+    close(fd);
+    
+    return bytes_read == 0 ? 0 : -1;
 }
 
-int main(void) {
-    calculate_scores();
+// Prints the scores of a hunt from its materialized scores.dat, which is
+// only recomputed from treasures.dat when it is missing or stale
+int calculate_hunt_scores(const char *hunt_id) {
+    ScoreTable table;
+    
+    if (load_hunt_scores(hunt_id, &table) == -1) {
+        return -1;
+    }
+    
+    print_scores(&table);
+    score_table_free(&table);
     return 0;
 }
+
+// Usage: score_calculator [--top K | --entries] [hunt_id]
+// With a hunt ID the scores are read from the hunt's score file,
+// without one "name,value,owner" lines are read from stdin. --top K
+// prints only the K best users, best first. --entries writes the hunt's
+// per-user totals as binary ScoreEntry records.
+int main(int argc, char *argv[]) {
+    size_t top = 0;
+    int arg = 1;
+    int result;
+    
+    if (argc > 2 && strcmp(argv[1], "--top") == 0) {
+        if (atoi(argv[2]) <= 0) {
+            printf("Format: score_calculator [--top K | --entries] [hunt_id]\n");
+            return 1;
+        }
+        top = atoi(argv[2]);
+        arg = 3;
+    } else if (argc > 2 && strcmp(argv[1], "--entries") == 0) {
+        return write_hunt_score_entries(argv[2]) == 0 ? 0 : 1;
+    }
+    
+    if (argc > arg && strcmp(argv[arg], "-") != 0) {
+        result = top > 0 ? calculate_hunt_top_scores(argv[arg], top)
+                         : calculate_hunt_scores(argv[arg]);
+    } else {
+        result = calculate_scores(top);
+    }
+    
+    return result == 0 ? 0 : 1;
+}
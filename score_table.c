@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "score_table.h"
+
+static uint32_t hash_name(const char *name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int score_table_init(ScoreTable *table) {
+    table->users = NULL;
+    table->user_count = 0;
+    table->user_capacity = 0;
+    table->slot_count = SCORE_TABLE_INITIAL_SLOTS;
+    table->slots = malloc(table->slot_count * sizeof(int32_t));
+    if (!table->slots) {
+        return -1;
+    }
+    memset(table->slots, -1, table->slot_count * sizeof(int32_t));
+    return 0;
+}
+
+void score_table_free(ScoreTable *table) {
+    for (size_t i = 0; i < table->user_count; i++) {
+        free(table->users[i].name);
+    }
+    free(table->users);
+    free(table->slots);
+}
+
+// Double the hash table and reinsert every user
+static int score_table_grow(ScoreTable *table) {
+    size_t slot_count = table->slot_count * 2;
+    int32_t *slots = malloc(slot_count * sizeof(int32_t));
+    
+    if (!slots) {
+        return -1;
+    }
+    memset(slots, -1, slot_count * sizeof(int32_t));
+    
+    for (size_t i = 0; i < table->user_count; i++) {
+        size_t slot = hash_name(table->users[i].name) & (slot_count - 1);
+        while (slots[slot] != -1) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = (int32_t)i;
+    }
+    
+    free(table->slots);
+    table->slots = slots;
+    table->slot_count = slot_count;
+    return 0;
+}
+
+// Append a user to users[] without hashing it
+static int score_table_push(ScoreTable *table, const char *name, long long value, long long count) {
+    if (table->user_count == table->user_capacity) {
+        size_t capacity = table->user_capacity ? table->user_capacity * 2 : 64;
+        UserScore *users = realloc(table->users, capacity * sizeof(UserScore));
+        if (!users) {
+            return -1;
+        }
+        table->users = users;
+        table->user_capacity = capacity;
+    }
+    
+    UserScore *user = &table->users[table->user_count];
+    user->name = malloc(strlen(name) + 1);
+    if (!user->name) {
+        return -1;
+    }
+    strcpy(user->name, name);
+    user->score = value;
+    user->count = count;
+    table->user_count++;
+    return 0;
+}
+
+int score_table_add(ScoreTable *table, const char *name, long long value, long long count) {
+    size_t slot = hash_name(name) & (table->slot_count - 1);
+    
+    while (table->slots[slot] != -1) {
+        UserScore *user = &table->users[table->slots[slot]];
+        if (strcmp(user->name, name) == 0) {
+            user->score += value;
+            user->count += count;
+            return 0;
+        }
+        slot = (slot + 1) & (table->slot_count - 1);
+    }
+    
+    // New user
+    if (score_table_push(table, name, value, count) == -1) {
+        return -1;
+    }
+    table->slots[slot] = (int32_t)(table->user_count - 1);
+    
+    // Keep the load factor under 3/4
+    if (table->user_count * 4 > table->slot_count * 3) {
+        return score_table_grow(table);
+    }
+    return 0;
+}
+
+int score_table_append(ScoreTable *table, const char *name, long long value, long long count) {
+    if (score_table_find(table, name) == -1) {
+        return score_table_add(table, name, value, count);
+    }
+    
+    // A repeat only takes up its position; lookups find the first one
+    return score_table_push(table, name, value, count);
+}
+
+long score_table_find(const ScoreTable *table, const char *name) {
+    size_t slot = hash_name(name) & (table->slot_count - 1);
+    
+    while (table->slots[slot] != -1) {
+        if (strcmp(table->users[table->slots[slot]].name, name) == 0) {
+            return table->slots[slot];
+        }
+        slot = (slot + 1) & (table->slot_count - 1);
+    }
+    
+    return -1;
+}
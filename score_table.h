@@ -0,0 +1,51 @@
+#ifndef SCORE_TABLE_H
+#define SCORE_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCORE_TABLE_INITIAL_SLOTS 1024  // Hash slots, always a power of two
+#define SCORE_NAME_SIZE 64              // Same as MAX_USERNAME in treasure_store.h
+
+typedef struct {
+    char *name;
+    long long score;               // Sum of the values of the user's treasures
+    long long count;               // Number of treasures counted
+} UserScore;
+
+// Per-user totals: users[] keeps insertion order for the output, and an
+// open-addressing hash table of indices into it finds a user by name
+typedef struct {
+    UserScore *users;
+    size_t user_count;
+    size_t user_capacity;
+    int32_t *slots;                // Index into users[], -1 when empty
+    size_t slot_count;
+} ScoreTable;
+
+// Fixed-size per-user total as stored in scores.dat and passed between
+// score_calculator and the hub
+typedef struct {
+    char username[SCORE_NAME_SIZE];
+    int64_t score;                 // Sum of the values of the user's active treasures
+    int64_t count;                 // Number of active treasures
+} ScoreEntry;
+
+// Set up an empty table. Returns 0 on success, -1 if out of memory.
+int score_table_init(ScoreTable *table);
+
+void score_table_free(ScoreTable *table);
+
+// Add value and count to the user's totals, creating the user on first
+// sight. Returns 0 on success, -1 if out of memory.
+int score_table_add(ScoreTable *table, const char *name, long long value, long long count);
+
+// Append a user to users[] even if the name is already there, so that
+// positions follow the order of the calls. Returns 0 on success, -1 if
+// out of memory.
+int score_table_append(ScoreTable *table, const char *name, long long value, long long count);
+
+// Index of the user in users[], or -1 if the table has no such user
+long score_table_find(const ScoreTable *table, const char *name);
+
+#endif
@@ -0,0 +1,635 @@
+#define _DEFAULT_SOURCE  // madvise
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "outbuf.h"
+#include "treasure_store.h"
+#include "spatial_index.h"
+#include "hunt_log.h"
+#include "hunt_journal.h"
+
+#define PI 3.14159265358979323846
+#define KM_PER_DEGREE (EARTH_RADIUS_KM * PI / 180.0)
+
+// Area searched by a query: a latitude/longitude box, and optionally the
+// radius around a center that matches must lie within
+typedef struct {
+    double min[2];                 // Latitude, longitude
+    double max[2];
+    double latitude;
+    double longitude;
+    double radius_km;              // Negative for a plain box query
+} SpatialQuery;
+
+// Get the path to the spatial index file for a hunt
+char* get_spatial_index_path(const char *hunt_id) {
+    static char spatial_path[MAX_PATH];
+    
+    strcpy(spatial_path, HUNT_DIR_PREFIX);
+    strcat(spatial_path, hunt_id);
+    strcat(spatial_path, "/spatial.idx");
+    
+    return spatial_path;
+}
+
+static float axis_value(const SpatialEntry *entry, int axis) {
+    return axis == 0 ? entry->latitude : entry->longitude;
+}
+
+static void swap_entries(SpatialEntry *a, SpatialEntry *b) {
+    SpatialEntry tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+// Reorder entries[lo, hi) so that entries[nth] holds the value it would
+// have if sorted on axis, with no larger values before it and no smaller
+// ones after it
+static void select_nth(SpatialEntry *entries, size_t lo, size_t hi, size_t nth, int axis) {
+    while (hi - lo > 1) {
+        float a = axis_value(&entries[lo], axis);
+        float b = axis_value(&entries[lo + (hi - lo) / 2], axis);
+        float c = axis_value(&entries[hi - 1], axis);
+        float pivot = (a < b) ? ((b < c) ? b : (a < c ? c : a)) : ((a < c) ? a : (b < c ? c : b));
+        size_t lt = lo, i = lo, gt = hi;
+        
+        // Three-way partition: [lo, lt) < pivot, [lt, gt) == pivot, [gt, hi) > pivot
+        while (i < gt) {
+            float value = axis_value(&entries[i], axis);
+            if (value < pivot) {
+                swap_entries(&entries[lt++], &entries[i++]);
+            } else if (value > pivot) {
+                swap_entries(&entries[i], &entries[--gt]);
+            } else {
+                i++;
+            }
+        }
+        
+        if (nth < lt) {
+            hi = lt;
+        } else if (nth >= gt) {
+            lo = gt;
+        } else {
+            return;
+        }
+    }
+}
+
+// Arrange entries[lo, hi) as an implicit k-d tree
+static void build_tree(SpatialEntry *entries, size_t lo, size_t hi, int depth) {
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        
+        select_nth(entries, lo, hi, mid, depth % 2);
+        build_tree(entries, lo, mid, depth + 1);
+        lo = mid + 1;
+        depth++;
+    }
+}
+
+// Recompute the spatial index from the treasure file and write it as the
+// index of the given generation. Returns 0 on success, -1 on error.
+int rebuild_spatial_index(const char *hunt_id, uint64_t generation) {
+    char spatial_path[MAX_PATH];
+    char temp_path[MAX_PATH + 24];
+    SpatialHeader header;
+    SpatialEntry *entries = NULL;
+    size_t capacity = 0;
+    TreasureScan scan;
+    const Treasure *treasure;
+    OutBuf *out;
+    int fd;
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = SPATIAL_MAGIC;
+    header.version = SPATIAL_VERSION;
+    header.generation = generation;
+    
+    fd = open(get_treasure_file_path(hunt_id), O_RDONLY);
+    if (fd == -1 && errno != ENOENT) {
+        perror("Failed to open treasure file");
+        return -1;
+    }
+    
+    // Collect the located active treasures
+    if (fd != -1) {
+        if (scan_open(&scan, hunt_id, fd) == -1) {
+            close(fd);
+            return -1;
+        }
+        
+        while ((treasure = scan_next(&scan)) != NULL) {
+            if (!treasure->is_active || !isfinite(treasure->latitude) || !isfinite(treasure->longitude) ||
+                fabsf(treasure->latitude) > 90.0f || fabsf(treasure->longitude) > 180.0f) {
+                continue;
+            }
+            
+            if ((size_t)header.count == capacity) {
+                capacity = capacity ? capacity * 2 : 1024;
+                SpatialEntry *grown = realloc(entries, capacity * sizeof(SpatialEntry));
+                if (!grown) {
+                    perror("Failed to allocate spatial index");
+                    free(entries);
+                    scan_close(&scan);
+                    close(fd);
+                    return -1;
+                }
+                entries = grown;
+            }
+            
+            SpatialEntry *entry = &entries[header.count++];
+            entry->latitude = treasure->latitude;
+            entry->longitude = treasure->longitude;
+            entry->id = treasure->id;
+            entry->reserved = 0;
+            
+            if (header.count == 1 || entry->latitude < header.min_latitude) {
+                header.min_latitude = entry->latitude;
+            }
+            if (header.count == 1 || entry->latitude > header.max_latitude) {
+                header.max_latitude = entry->latitude;
+            }
+            if (header.count == 1 || entry->longitude < header.min_longitude) {
+                header.min_longitude = entry->longitude;
+            }
+            if (header.count == 1 || entry->longitude > header.max_longitude) {
+                header.max_longitude = entry->longitude;
+            }
+        }
+        
+        scan_close(&scan);
+        close(fd);
+    }
+    
+    build_tree(entries, 0, header.count, 0);
+    
+    strcpy(spatial_path, get_spatial_index_path(hunt_id));
+    strcpy(temp_path, spatial_path);
+    sprintf(temp_path + strlen(temp_path), ".%d.tmp", (int)getpid());
+    
+    out = malloc(sizeof(OutBuf));
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (!out || fd == -1) {
+        perror("Failed to create spatial index");
+        if (fd != -1) {
+            close(fd);
+            unlink(temp_path);
+        }
+        free(out);
+        free(entries);
+        return -1;
+    }
+    
+    outbuf_init(out, fd);
+    outbuf_write(out, &header, sizeof(header));
+    outbuf_write(out, entries, header.count * sizeof(SpatialEntry));
+    free(entries);
+    
+    if (outbuf_flush(out) == -1) {
+        perror("Failed to write spatial index");
+        free(out);
+        close(fd);
+        unlink(temp_path);
+        return -1;
+    }
+    free(out);
+    close(fd);
+    
+    if (rename(temp_path, spatial_path) == -1) {
+        perror("Failed to install spatial index");
+        unlink(temp_path);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Map a hunt's spatial index, rebuilding it first if it is missing or does
+// not match the current meta generation. Returns 0 on success, -1 on error
+// and -2 if the hunt has no treasure file.
+int spatial_open(const char *hunt_id, SpatialIndex *index) {
+    struct stat file_stat;
+    HuntMeta meta;
+    
+    memset(index, 0, sizeof(SpatialIndex));
+    
+    if (stat(get_treasure_file_path(hunt_id), &file_stat) == -1) {
+        if (errno != ENOENT) {
+            perror("Failed to get file stats");
+            return -1;
+        }
+        return -2;
+    }
+    
+    if (load_hunt_meta(hunt_id, &meta, file_stat.st_size) == -1) {
+        return -1;
+    }
+    
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = open(get_spatial_index_path(hunt_id), O_RDONLY);
+        
+        if (fd != -1) {
+            if (pread(fd, &index->header, sizeof(SpatialHeader), 0) == sizeof(SpatialHeader) &&
+                index->header.magic == SPATIAL_MAGIC && index->header.version == SPATIAL_VERSION &&
+                index->header.generation == meta.generation && fstat(fd, &file_stat) == 0 &&
+                file_stat.st_size >= (off_t)(sizeof(SpatialHeader) +
+                                             index->header.count * sizeof(SpatialEntry))) {
+                if (index->header.count == 0) {
+                    close(fd);
+                    return 0;
+                }
+                
+                index->map_len = sizeof(SpatialHeader) + index->header.count * sizeof(SpatialEntry);
+                index->map = mmap(NULL, index->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (index->map == MAP_FAILED) {
+                    perror("Failed to map spatial index");
+                    index->map = NULL;
+                    return -1;
+                }
+                madvise(index->map, index->map_len, MADV_RANDOM);
+                index->entries = (const SpatialEntry *)((const char *)index->map + sizeof(SpatialHeader));
+                return 0;
+            }
+            close(fd);
+        } else if (errno != ENOENT) {
+            perror("Failed to open spatial index");
+            return -1;
+        }
+        
+        if (attempt == 0 && rebuild_spatial_index(hunt_id, meta.generation) == -1) {
+            return -1;
+        }
+    }
+    
+    return -1;
+}
+
+void spatial_close(SpatialIndex *index) {
+    if (index->map) {
+        munmap(index->map, index->map_len);
+    }
+    memset(index, 0, sizeof(SpatialIndex));
+}
+
+// Great-circle distance between two points (haversine formula)
+double distance_km(double lat1, double lon1, double lat2, double lon2) {
+    double dlat = (lat2 - lat1) * PI / 180.0;
+    double dlon = (lon2 - lon1) * PI / 180.0;
+    double a = sin(dlat / 2) * sin(dlat / 2) +
+               cos(lat1 * PI / 180.0) * cos(lat2 * PI / 180.0) * sin(dlon / 2) * sin(dlon / 2);
+    
+    return 2.0 * EARTH_RADIUS_KM * asin(sqrt(a < 1.0 ? a : 1.0));
+}
+
+static int add_match(SpatialResult *result, const SpatialEntry *entry, double distance) {
+    if (result->count == result->capacity) {
+        size_t capacity = result->capacity ? result->capacity * 2 : 64;
+        SpatialMatch *matches = realloc(result->matches, capacity * sizeof(SpatialMatch));
+        if (!matches) {
+            perror("Failed to allocate query results");
+            return -1;
+        }
+        result->matches = matches;
+        result->capacity = capacity;
+    }
+    
+    result->matches[result->count].id = entry->id;
+    result->matches[result->count].latitude = entry->latitude;
+    result->matches[result->count].longitude = entry->longitude;
+    result->matches[result->count].distance = distance;
+    result->count++;
+    return 0;
+}
+
+// Walk the subtree of entries[lo, hi) and collect the entries in the query
+// area, skipping subtrees that lie on the wrong side of a split
+static int query_tree(const SpatialEntry *entries, size_t lo, size_t hi, int depth,
+                      const SpatialQuery *query, SpatialResult *result) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const SpatialEntry *entry = &entries[mid];
+        int axis = depth % 2;
+        double value = axis_value(entry, axis);
+        
+        if (entry->latitude >= query->min[0] && entry->latitude <= query->max[0] &&
+            entry->longitude >= query->min[1] && entry->longitude <= query->max[1]) {
+            double distance = 0.0;
+            
+            if (query->radius_km >= 0) {
+                distance = distance_km(query->latitude, query->longitude, entry->latitude, entry->longitude);
+            }
+            if ((query->radius_km < 0 || distance <= query->radius_km) &&
+                add_match(result, entry, distance) == -1) {
+                return -1;
+            }
+        }
+        
+        if (query->min[axis] <= value && query_tree(entries, lo, mid, depth + 1, query, result) == -1) {
+            return -1;
+        }
+        if (query->max[axis] < value) {
+            break;
+        }
+        lo = mid + 1;
+        depth++;
+    }
+    
+    return 0;
+}
+
+// Run a query whose longitude range may extend past +-180 degrees, as one
+// or two box queries
+static int query_wrapped(const SpatialIndex *index, SpatialQuery query, SpatialResult *result) {
+    if (index->header.count == 0) {
+        return 0;
+    }
+    
+    if (query.max[1] - query.min[1] >= 360.0) {
+        query.min[1] = -180.0;
+        query.max[1] = 180.0;
+    } else if (query.min[1] < -180.0) {
+        SpatialQuery east = query;
+        east.min[1] += 360.0;
+        east.max[1] = 180.0;
+        query.min[1] = -180.0;
+        if (query_tree(index->entries, 0, index->header.count, 0, &east, result) == -1) {
+            return -1;
+        }
+    } else if (query.max[1] > 180.0) {
+        SpatialQuery west = query;
+        west.min[1] = -180.0;
+        west.max[1] -= 360.0;
+        query.max[1] = 180.0;
+        if (query_tree(index->entries, 0, index->header.count, 0, &west, result) == -1) {
+            return -1;
+        }
+    }
+    
+    return query_tree(index->entries, 0, index->header.count, 0, &query, result);
+}
+
+static int compare_by_id(const void *a, const void *b) {
+    const SpatialMatch *x = a;
+    const SpatialMatch *y = b;
+    
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int compare_by_distance(const void *a, const void *b) {
+    const SpatialMatch *x = a;
+    const SpatialMatch *y = b;
+    
+    if (x->distance != y->distance) {
+        return x->distance < y->distance ? -1 : 1;
+    }
+    return compare_by_id(a, b);
+}
+
+// Collect the treasures inside a latitude/longitude box, sorted by ID. A
+// box with min_lon > max_lon crosses the 180th meridian. Returns 0 on
+// success.
+int spatial_bbox(const SpatialIndex *index, double min_lat, double min_lon, double max_lat,
+                 double max_lon, SpatialResult *result) {
+    SpatialQuery query;
+    
+    query.min[0] = min_lat;
+    query.max[0] = max_lat;
+    query.min[1] = min_lon;
+    query.max[1] = (min_lon > max_lon) ? max_lon + 360.0 : max_lon;
+    query.latitude = query.longitude = 0.0;
+    query.radius_km = -1.0;
+    
+    if (query_wrapped(index, query, result) == -1) {
+        return -1;
+    }
+    
+    qsort(result->matches, result->count, sizeof(SpatialMatch), compare_by_id);
+    return 0;
+}
+
+// Collect the treasures within radius_km of a point, nearest first.
+// Returns 0 on success.
+int spatial_near(const SpatialIndex *index, double lat, double lon, double radius_km,
+                 SpatialResult *result) {
+    double angle = radius_km / EARTH_RADIUS_KM;
+    double dlat = angle * 180.0 / PI;
+    SpatialQuery query;
+    
+    query.latitude = lat;
+    query.longitude = lon;
+    query.radius_km = radius_km;
+    query.min[0] = lat - dlat;
+    query.max[0] = lat + dlat;
+    
+    // The circle's longitude span; it covers every longitude once it
+    // reaches a pole
+    if (query.min[0] <= -90.0 || query.max[0] >= 90.0 || angle >= PI / 2) {
+        query.min[1] = -180.0;
+        query.max[1] = 180.0;
+    } else {
+        double dlon = asin(sin(angle) / cos(lat * PI / 180.0)) * 180.0 / PI;
+        query.min[1] = lon - dlon;
+        query.max[1] = lon + dlon;
+    }
+    
+    if (query_wrapped(index, query, result) == -1) {
+        return -1;
+    }
+    
+    qsort(result->matches, result->count, sizeof(SpatialMatch), compare_by_distance);
+    return 0;
+}
+
+// Collect the k treasures nearest to a point, nearest first. The search
+// radius starts at the distance expected to hold k treasures if they were
+// spread evenly over the hunt's area and doubles until it does.
+int spatial_nearest(const SpatialIndex *index, double lat, double lon, size_t k, SpatialResult *result) {
+    const SpatialHeader *header = &index->header;
+    double height, width, radius;
+    
+    if (k > (size_t)header->count) {
+        k = header->count;
+    }
+    if (k == 0) {
+        return 0;
+    }
+    
+    height = (header->max_latitude - header->min_latitude) * KM_PER_DEGREE;
+    width = (header->max_longitude - header->min_longitude) * KM_PER_DEGREE *
+            cos((header->min_latitude + header->max_latitude) / 2.0 * PI / 180.0);
+    radius = sqrt(height * width * k / (header->count * PI));
+    if (!(radius > 0.001)) {
+        radius = 0.001;
+    }
+    
+    for (;;) {
+        result->count = 0;
+        if (spatial_near(index, lat, lon, radius, result) == -1) {
+            return -1;
+        }
+        if (result->count >= k || radius >= PI * EARTH_RADIUS_KM) {
+            break;
+        }
+        radius *= 2;
+    }
+    
+    if (result->count > k) {
+        result->count = k;
+    }
+    return 0;
+}
+
+// Print query results with the details of each treasure
+static void print_matches(const char *hunt_id, const SpatialResult *result, int with_distance, OutBuf *out) {
+    int fd = open_treasure_file(hunt_id);
+    Treasure treasure;
+    size_t printed = 0;
+    
+    outbuf_printf(out, "--------------------------------------------------\n");
+    for (size_t i = 0; fd != -1 && i < result->count; i++) {
+        const SpatialMatch *match = &result->matches[i];
+        
+        if (!find_treasure(hunt_id, fd, match->id, &treasure, NULL)) {
+            continue;
+        }
+        outbuf_printf(out, "ID: %d | User: %s | Value: %d | Location: %.6f, %.6f", treasure.id,
+                      treasure.username, treasure.value, treasure.latitude, treasure.longitude);
+        if (with_distance) {
+            outbuf_printf(out, " | Distance: %.3f km", match->distance);
+        }
+        outbuf_printf(out, "\n");
+        printed++;
+    }
+    if (printed == 0) {
+        outbuf_printf(out, "No treasures found.\n");
+    }
+    outbuf_printf(out, "--------------------------------------------------\n");
+    outbuf_printf(out, "Total treasures: %zu\n", printed);
+}
+
+// Lock the hunt for reading and open the spatial index for a query
+// command, printing why if it cannot be used. Returns 0 when the index is
+// open (and the hunt locked until unlock_hunt()), 1 if the hunt has no
+// treasures, -1 on error.
+static int open_for_query(const char *hunt_id, SpatialIndex *index) {
+    int result;
+    
+    if (lock_hunt(hunt_id, HUNT_LOCK_READ) == -1) {
+        return -1;
+    }
+    
+    result = spatial_open(hunt_id, index);
+    if (result != 0) {
+        unlock_hunt(hunt_id);
+    }
+    if (result == -2) {
+        printf("Hunt '%s' has no treasures or does not exist.\n", hunt_id);
+        return 1;
+    }
+    return result;
+}
+
+// List the treasures within radius_km of a point, nearest first.
+// Returns 0 on success, -1 on error.
+int near_treasures(const char *hunt_id, double lat, double lon, double radius_km) {
+    SpatialIndex index;
+    SpatialResult result = { NULL, 0, 0 };
+    char search_area[256];
+    OutBuf out;
+    int status;
+    
+    if ((status = open_for_query(hunt_id, &index)) != 0) {
+        return status == 1 ? 0 : -1;
+    }
+    
+    status = spatial_near(&index, lat, lon, radius_km, &result);
+    if (status == 0) {
+        outbuf_init(&out, STDOUT_FILENO);
+        outbuf_printf(&out, "Treasures within %.3f km of %.6f, %.6f in hunt '%s':\n", radius_km, lat, lon,
+                      hunt_id);
+        print_matches(hunt_id, &result, 1, &out);
+        outbuf_flush(&out);
+        
+        snprintf(search_area, sizeof(search_area), "within %.3f km of %.6f, %.6f",
+                 radius_km, lat, lon);
+        log_event(hunt_id, LOG_OP_SEARCH, 0, NULL, 0, search_area);
+    }
+    
+    free(result.matches);
+    spatial_close(&index);
+    unlock_hunt(hunt_id);
+    return status;
+}
+
+// List the treasures inside a latitude/longitude box by ID. Returns 0 on
+// success, -1 on error.
+int bbox_treasures(const char *hunt_id, double min_lat, double min_lon, double max_lat, double max_lon) {
+    SpatialIndex index;
+    SpatialResult result = { NULL, 0, 0 };
+    char search_area[256];
+    OutBuf out;
+    int status;
+    
+    if ((status = open_for_query(hunt_id, &index)) != 0) {
+        return status == 1 ? 0 : -1;
+    }
+    
+    status = spatial_bbox(&index, min_lat, min_lon, max_lat, max_lon, &result);
+    if (status == 0) {
+        outbuf_init(&out, STDOUT_FILENO);
+        outbuf_printf(&out, "Treasures between %.6f, %.6f and %.6f, %.6f in hunt '%s':\n", min_lat, min_lon,
+                      max_lat, max_lon, hunt_id);
+        print_matches(hunt_id, &result, 0, &out);
+        outbuf_flush(&out);
+        
+        snprintf(search_area, sizeof(search_area), "between %.6f, %.6f and %.6f, %.6f",
+                 min_lat, min_lon, max_lat, max_lon);
+        log_event(hunt_id, LOG_OP_SEARCH, 0, NULL, 0, search_area);
+    }
+    
+    free(result.matches);
+    spatial_close(&index);
+    unlock_hunt(hunt_id);
+    return status;
+}
+
+// List the k treasures nearest to a point. Returns 0 on success, -1 on
+// error.
+int nearest_treasures(const char *hunt_id, double lat, double lon, int k) {
+    SpatialIndex index;
+    SpatialResult result = { NULL, 0, 0 };
+    char search_area[256];
+    OutBuf out;
+    int status;
+    
+    if ((status = open_for_query(hunt_id, &index)) != 0) {
+        return status == 1 ? 0 : -1;
+    }
+    
+    status = spatial_nearest(&index, lat, lon, k > 0 ? (size_t)k : 0, &result);
+    if (status == 0) {
+        outbuf_init(&out, STDOUT_FILENO);
+        outbuf_printf(&out, "The %d treasures nearest to %.6f, %.6f in hunt '%s':\n", k, lat, lon, hunt_id);
+        print_matches(hunt_id, &result, 1, &out);
+        outbuf_flush(&out);
+        
+        snprintf(search_area, sizeof(search_area), "for the %d treasures nearest to %.6f, %.6f",
+                 k, lat, lon);
+        log_event(hunt_id, LOG_OP_SEARCH, 0, NULL, 0, search_area);
+    }
+    
+    free(result.matches);
+    spatial_close(&index);
+    unlock_hunt(hunt_id);
+    return status;
+}
@@ -0,0 +1,76 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SPATIAL_MAGIC 0x58505354    // "TSPX"
+#define SPATIAL_VERSION 1
+#define EARTH_RADIUS_KM 6371.0088   // Mean Earth radius
+
+// Header of the per-hunt spatial index (hunts/<id>/spatial.idx), followed
+// by one SpatialEntry per active treasure with a valid location, laid out
+// as an implicit k-d tree: the entry in the middle of any range splits it
+// on latitude (even depth) or longitude (odd depth), with smaller values
+// before it and larger ones after it. Like scores.dat the file is stamped
+// with the meta generation it describes, and a stale file is rebuilt by
+// the next query.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+    int64_t count;
+    float min_latitude;            // Bounds of all entries
+    float max_latitude;
+    float min_longitude;
+    float max_longitude;
+} SpatialHeader;
+
+typedef struct {
+    float latitude;
+    float longitude;
+    int32_t id;
+    int32_t reserved;
+} SpatialEntry;
+
+// Mapped spatial index of a hunt
+typedef struct {
+    SpatialHeader header;
+    const SpatialEntry *entries;
+    void *map;
+    size_t map_len;
+} SpatialIndex;
+
+// Query result: a treasure and its distance from the query point (0 for
+// bounding-box queries)
+typedef struct {
+    int32_t id;
+    float latitude;
+    float longitude;
+    double distance;
+} SpatialMatch;
+
+// Growable list of query results
+typedef struct {
+    SpatialMatch *matches;
+    size_t count;
+    size_t capacity;
+} SpatialResult;
+
+// Function prototypes
+char* get_spatial_index_path(const char *hunt_id);
+int rebuild_spatial_index(const char *hunt_id, uint64_t generation);
+int spatial_open(const char *hunt_id, SpatialIndex *index);
+void spatial_close(SpatialIndex *index);
+double distance_km(double lat1, double lon1, double lat2, double lon2);
+int spatial_bbox(const SpatialIndex *index, double min_lat, double min_lon, double max_lat,
+                 double max_lon, SpatialResult *result);
+int spatial_near(const SpatialIndex *index, double lat, double lon, double radius_km,
+                 SpatialResult *result);
+int spatial_nearest(const SpatialIndex *index, double lat, double lon, size_t k, SpatialResult *result);
+int near_treasures(const char *hunt_id, double lat, double lon, double radius_km);
+int bbox_treasures(const char *hunt_id, double min_lat, double min_lon, double max_lat, double max_lon);
+int nearest_treasures(const char *hunt_id, double lat, double lon, int k);
+
+#endif
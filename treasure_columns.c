@@ -0,0 +1,598 @@
+#define _DEFAULT_SOURCE  // pread/pwrite
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "outbuf.h"
+#include "treasure_columns.h"
+
+// Files of the columnar layout, in ColumnSet/ColumnAppend order
+enum {
+    FILE_ID,
+    FILE_VALUE,
+    FILE_LATITUDE,
+    FILE_LONGITUDE,
+    FILE_ACTIVE,
+    FILE_USERNAME_OFFSETS,
+    FILE_USERNAME_HEAP,
+    FILE_CLUE_OFFSETS,
+    FILE_CLUE_HEAP
+};
+
+static const struct {
+    const char *name;
+    uint32_t column;               // COLUMN_* bit that selects the file
+    size_t width;                  // Bytes per row, 0 for the bitmap and heaps
+} column_files[COLUMN_FILE_COUNT] = {
+    { "id.col",        COLUMN_ID,       sizeof(int32_t) },
+    { "value.col",     COLUMN_VALUE,    sizeof(int32_t) },
+    { "latitude.col",  COLUMN_LOCATION, sizeof(float) },
+    { "longitude.col", COLUMN_LOCATION, sizeof(float) },
+    { "active.col",    COLUMN_ACTIVE,   0 },
+    { "username.off",  COLUMN_USERNAME, sizeof(uint64_t) },
+    { "username.heap", COLUMN_USERNAME, 0 },
+    { "clue.off",      COLUMN_CLUE,     sizeof(uint64_t) },
+    { "clue.heap",     COLUMN_CLUE,     0 }
+};
+
+// Get the path to the columns directory of a hunt
+char* get_columns_dir_path(const char *hunt_id) {
+    static char columns_path[MAX_PATH];
+    
+    strcpy(columns_path, HUNT_DIR_PREFIX);
+    strcat(columns_path, hunt_id);
+    strcat(columns_path, "/columns");
+    
+    return columns_path;
+}
+
+// Get the path to one file of the columns directory
+static char* column_file_path(const char *hunt_id, const char *name) {
+    static char file_path[MAX_PATH + 32];
+    
+    snprintf(file_path, sizeof(file_path), "%s/%s", get_columns_dir_path(hunt_id), name);
+    return file_path;
+}
+
+// Valid bytes of a column file for the rows and heaps in the header
+static off_t column_file_size(int file, const ColumnsHeader *header) {
+    if (file == FILE_ACTIVE) {
+        return (header->row_count + 7) / 8;
+    }
+    if (file == FILE_USERNAME_HEAP) {
+        return header->username_heap_size;
+    }
+    if (file == FILE_CLUE_HEAP) {
+        return header->clue_heap_size;
+    }
+    return header->row_count * (off_t)column_files[file].width;
+}
+
+static int read_columns_header(const char *hunt_id, ColumnsHeader *header) {
+    int fd = open(column_file_path(hunt_id, "header"), O_RDONLY);
+    ssize_t bytes_read;
+    
+    if (fd == -1) {
+        return -1;
+    }
+    
+    bytes_read = read(fd, header, sizeof(ColumnsHeader));
+    close(fd);
+    
+    if (bytes_read != sizeof(ColumnsHeader) ||
+        header->magic != COLUMNS_MAGIC || header->version != COLUMNS_VERSION) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Whether the hunt has a columnar layout (current or not)
+int columns_exist(const char *hunt_id) {
+    struct stat file_stat;
+    
+    return stat(column_file_path(hunt_id, "header"), &file_stat) == 0;
+}
+
+// Drop the columnar layout of a hunt
+void remove_columns(const char *hunt_id) {
+    // The header goes first, so the files are never used half removed
+    unlink(column_file_path(hunt_id, "header"));
+    
+    for (int i = 0; i < COLUMN_FILE_COUNT; i++) {
+        unlink(column_file_path(hunt_id, column_files[i].name));
+    }
+    
+    rmdir(get_columns_dir_path(hunt_id));
+}
+
+// Write the columnar layout of a hunt from its treasure file, replacing any
+// existing one. Returns the number of rows written, or -1 on error.
+int convert_to_columns(const char *hunt_id) {
+    struct stat file_stat;
+    HuntMeta meta;
+    ColumnsHeader header;
+    TreasureScan scan;
+    const Treasure *treasure;
+    OutBuf *outs;
+    uint8_t active_byte = 0;
+    int last_id = 0;
+    int fd, header_fd;
+    int result = 0;
+    
+    fd = open(get_treasure_file_path(hunt_id), O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            printf("Hunt '%s' has no treasures or does not exist.\n", hunt_id);
+        } else {
+            perror("Failed to open treasure file");
+        }
+        return -1;
+    }
+    
+    if (fstat(fd, &file_stat) == -1 || load_hunt_meta(hunt_id, &meta, file_stat.st_size) == -1) {
+        perror("Failed to read hunt state");
+        close(fd);
+        return -1;
+    }
+    
+    // Readers must not see the old header over half-written columns
+    unlink(column_file_path(hunt_id, "header"));
+    if (mkdir(get_columns_dir_path(hunt_id), 0755) == -1 && errno != EEXIST) {
+        perror("Failed to create columns directory");
+        close(fd);
+        return -1;
+    }
+    
+    outs = malloc(COLUMN_FILE_COUNT * sizeof(OutBuf));
+    if (!outs) {
+        perror("Failed to allocate column buffers");
+        close(fd);
+        return -1;
+    }
+    
+    for (int i = 0; i < COLUMN_FILE_COUNT; i++) {
+        int column_fd = open(column_file_path(hunt_id, column_files[i].name),
+                             O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (column_fd == -1) {
+            perror("Failed to create column file");
+            while (--i >= 0) {
+                close(outs[i].fd);
+            }
+            free(outs);
+            close(fd);
+            return -1;
+        }
+        outbuf_init(&outs[i], column_fd);
+    }
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = COLUMNS_MAGIC;
+    header.version = COLUMNS_VERSION;
+    header.generation = meta.generation;
+    header.flags = COLUMNS_IDS_SORTED;
+    
+    if (scan_open(&scan, hunt_id, fd) == -1) {
+        result = -1;
+    }
+    
+    // Split every record over the column files
+    while (result == 0 && (treasure = scan_next(&scan)) != NULL) {
+        int32_t id = treasure->id;
+        int32_t value = treasure->value;
+        uint64_t username_offset = header.username_heap_size;
+        uint64_t clue_offset = header.clue_heap_size;
+        size_t username_len = strnlen(treasure->username, MAX_USERNAME - 1);
+        size_t clue_len = strnlen(treasure->clue, MAX_CLUE - 1);
+        
+        if (header.row_count > 0 && treasure->id <= last_id) {
+            header.flags &= ~COLUMNS_IDS_SORTED;
+        }
+        last_id = treasure->id;
+        
+        outbuf_write(&outs[FILE_ID], &id, sizeof(id));
+        outbuf_write(&outs[FILE_VALUE], &value, sizeof(value));
+        outbuf_write(&outs[FILE_LATITUDE], &treasure->latitude, sizeof(float));
+        outbuf_write(&outs[FILE_LONGITUDE], &treasure->longitude, sizeof(float));
+        outbuf_write(&outs[FILE_USERNAME_OFFSETS], &username_offset, sizeof(username_offset));
+        outbuf_write(&outs[FILE_USERNAME_HEAP], treasure->username, username_len);
+        outbuf_write(&outs[FILE_USERNAME_HEAP], "", 1);
+        outbuf_write(&outs[FILE_CLUE_OFFSETS], &clue_offset, sizeof(clue_offset));
+        outbuf_write(&outs[FILE_CLUE_HEAP], treasure->clue, clue_len);
+        outbuf_write(&outs[FILE_CLUE_HEAP], "", 1);
+        
+        if (treasure->is_active) {
+            active_byte |= 1u << (header.row_count % 8);
+        }
+        header.row_count++;
+        if (header.row_count % 8 == 0) {
+            outbuf_write(&outs[FILE_ACTIVE], &active_byte, 1);
+            active_byte = 0;
+        }
+        
+        header.username_heap_size += username_len + 1;
+        header.clue_heap_size += clue_len + 1;
+    }
+    if (result == 0) {
+        scan_close(&scan);
+    }
+    close(fd);
+    
+    if (header.row_count % 8 != 0) {
+        outbuf_write(&outs[FILE_ACTIVE], &active_byte, 1);
+    }
+    
+    for (int i = 0; i < COLUMN_FILE_COUNT; i++) {
+        if (outbuf_flush(&outs[i]) == -1) {
+            result = -1;
+        }
+        close(outs[i].fd);
+    }
+    free(outs);
+    
+    // The header makes the columns visible
+    header_fd = open(column_file_path(hunt_id, "header"), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (result == -1 || header_fd == -1 ||
+        write(header_fd, &header, sizeof(header)) != sizeof(header)) {
+        perror("Failed to write columns");
+        if (header_fd != -1) {
+            close(header_fd);
+        }
+        remove_columns(hunt_id);
+        return -1;
+    }
+    close(header_fd);
+    
+    return (int)header.row_count;
+}
+
+// Map the selected columns of a hunt. Returns 0 on success, -1 if the hunt
+// has no columnar layout or it does not match the current meta generation
+// (the caller then reads treasures.dat instead).
+int columns_open(const char *hunt_id, uint32_t wanted, ColumnSet *set) {
+    struct stat file_stat;
+    HuntMeta meta;
+    
+    memset(set, 0, sizeof(ColumnSet));
+    
+    if (read_columns_header(hunt_id, &set->header) == -1) {
+        return -1;
+    }
+    
+    if (stat(get_treasure_file_path(hunt_id), &file_stat) == -1 ||
+        read_hunt_meta(hunt_id, &meta) == -1 || meta.data_size != file_stat.st_size ||
+        meta.generation != set->header.generation) {
+        return -1;
+    }
+    
+    for (int i = 0; i < COLUMN_FILE_COUNT; i++) {
+        off_t size = column_file_size(i, &set->header);
+        int fd;
+        
+        if (!(column_files[i].column & wanted) || size == 0) {
+            continue;
+        }
+        
+        fd = open(column_file_path(hunt_id, column_files[i].name), O_RDONLY);
+        if (fd == -1 || fstat(fd, &file_stat) == -1 || file_stat.st_size < size) {
+            if (fd != -1) {
+                close(fd);
+            }
+            columns_close(set);
+            return -1;
+        }
+        
+        set->maps[i] = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (set->maps[i] == MAP_FAILED) {
+            set->maps[i] = NULL;
+            columns_close(set);
+            return -1;
+        }
+        set->map_lens[i] = size;
+    }
+    
+    set->ids = set->maps[FILE_ID];
+    set->values = set->maps[FILE_VALUE];
+    set->latitudes = set->maps[FILE_LATITUDE];
+    set->longitudes = set->maps[FILE_LONGITUDE];
+    set->active = set->maps[FILE_ACTIVE];
+    set->username_offsets = set->maps[FILE_USERNAME_OFFSETS];
+    set->username_heap = set->maps[FILE_USERNAME_HEAP];
+    set->clue_offsets = set->maps[FILE_CLUE_OFFSETS];
+    set->clue_heap = set->maps[FILE_CLUE_HEAP];
+    
+    return 0;
+}
+
+void columns_close(ColumnSet *set) {
+    for (int i = 0; i < COLUMN_FILE_COUNT; i++) {
+        if (set->maps[i]) {
+            munmap(set->maps[i], set->map_lens[i]);
+            set->maps[i] = NULL;
+        }
+    }
+}
+
+// Find the row of an active treasure in a set opened with COLUMN_ID and
+// COLUMN_ACTIVE. Returns the row, or -1 if there is none.
+int64_t columns_find_row(const ColumnSet *set, int treasure_id) {
+    int64_t low = 0, high = set->header.row_count - 1;
+    
+    if (!(set->header.flags & COLUMNS_IDS_SORTED)) {
+        for (int64_t row = 0; row < set->header.row_count; row++) {
+            if (set->ids[row] == treasure_id && COLUMN_ROW_ACTIVE(set, row)) {
+                return row;
+            }
+        }
+        return -1;
+    }
+    
+    // IDs are ascending: binary search the ID column only
+    while (low <= high) {
+        int64_t middle = low + (high - low) / 2;
+        
+        if (set->ids[middle] == treasure_id) {
+            return COLUMN_ROW_ACTIVE(set, middle) ? middle : -1;
+        }
+        if (set->ids[middle] < treasure_id) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    
+    return -1;
+}
+
+// Rebuild the record of a row from a set opened with COLUMN_ALL
+void columns_get_treasure(const ColumnSet *set, int64_t row, Treasure *treasure) {
+    memset(treasure, 0, sizeof(Treasure));
+    treasure->id = set->ids[row];
+    treasure->value = set->values[row];
+    treasure->latitude = set->latitudes[row];
+    treasure->longitude = set->longitudes[row];
+    treasure->is_active = COLUMN_ROW_ACTIVE(set, row);
+    strncpy(treasure->username, set->username_heap + set->username_offsets[row], MAX_USERNAME - 1);
+    strncpy(treasure->clue, set->clue_heap + set->clue_offsets[row], MAX_CLUE - 1);
+}
+
+// Open the columns of a hunt for appending rows. generation is the meta
+// generation before the change. Returns 0 when the columns are ready, -1
+// when the hunt has no columnar layout or it was stale (it is dropped).
+int columns_begin_append(const char *hunt_id, uint64_t generation, ColumnAppend *append) {
+    int32_t last_id;
+    
+    memset(append, 0, sizeof(ColumnAppend));
+    append->header_fd = -1;
+    for (int i = 0; i < COLUMN_FILE_COUNT; i++) {
+        append->fds[i] = -1;
+    }
+    
+    if (read_columns_header(hunt_id, &append->header) == -1) {
+        return -1;
+    }
+    if (append->header.generation != generation) {
+        remove_columns(hunt_id);
+        return -1;
+    }
+    
+    append->header_fd = open(column_file_path(hunt_id, "header"), O_WRONLY);
+    for (int i = 0; i < COLUMN_FILE_COUNT; i++) {
+        append->fds[i] = open(column_file_path(hunt_id, column_files[i].name), O_RDWR);
+        if (append->fds[i] == -1) {
+            break;
+        }
+    }
+    if (append->header_fd == -1 || append->fds[COLUMN_FILE_COUNT - 1] == -1) {
+        columns_abort_append(append);
+        remove_columns(hunt_id);
+        return -1;
+    }
+    
+    // Carry on from the last row: its ID and the partial bitmap byte
+    if (append->header.row_count > 0) {
+        if (pread(append->fds[FILE_ID], &last_id, sizeof(last_id),
+                  (append->header.row_count - 1) * sizeof(int32_t)) != sizeof(last_id) ||
+            (append->header.row_count % 8 != 0 &&
+             pread(append->fds[FILE_ACTIVE], &append->last_active, 1,
+                   append->header.row_count / 8) != 1)) {
+            columns_abort_append(append);
+            remove_columns(hunt_id);
+            return -1;
+        }
+        append->last_id = last_id;
+    }
+    
+    return 0;
+}
+
+// Write a batch of new (active) records after the last row. The rows
+// only become visible in columns_finish_append(). Returns 0 on success.
+int columns_append(ColumnAppend *append, const Treasure *records, size_t count) {
+    ColumnsHeader *header = &append->header;
+    size_t active_len = (header->row_count % 8 + count + 7) / 8;
+    int32_t *ints = malloc(count * sizeof(int32_t) * 2);
+    float *floats = malloc(count * sizeof(float) * 2);
+    uint64_t *offsets = malloc(count * sizeof(uint64_t) * 2);
+    char *usernames = malloc(count * MAX_USERNAME);
+    char *clues = malloc(count * MAX_CLUE);
+    uint8_t *active = calloc(active_len, 1);
+    size_t usernames_len = 0, clues_len = 0;
+    int result = -1;
+    
+    if (ints && floats && offsets && usernames && clues && active) {
+        for (size_t i = 0; i < count; i++) {
+            size_t username_len = strnlen(records[i].username, MAX_USERNAME - 1);
+            size_t clue_len = strnlen(records[i].clue, MAX_CLUE - 1);
+            
+            if (records[i].id <= append->last_id) {
+                header->flags &= ~COLUMNS_IDS_SORTED;
+            }
+            append->last_id = records[i].id;
+            
+            ints[i] = records[i].id;
+            ints[count + i] = records[i].value;
+            floats[i] = records[i].latitude;
+            floats[count + i] = records[i].longitude;
+            offsets[i] = header->username_heap_size + usernames_len;
+            offsets[count + i] = header->clue_heap_size + clues_len;
+            memcpy(usernames + usernames_len, records[i].username, username_len);
+            usernames[usernames_len + username_len] = '\0';
+            usernames_len += username_len + 1;
+            memcpy(clues + clues_len, records[i].clue, clue_len);
+            clues[clues_len + clue_len] = '\0';
+            clues_len += clue_len + 1;
+        }
+        
+        // New rows are active; the first byte may continue a partial one
+        active[0] = append->last_active;
+        for (size_t i = 0; i < count; i++) {
+            size_t bit = header->row_count % 8 + i;
+            active[bit / 8] |= 1u << (bit % 8);
+        }
+        
+        off_t row = header->row_count;
+        if (pwrite(append->fds[FILE_ID], ints, count * sizeof(int32_t), row * sizeof(int32_t)) != (ssize_t)(count * sizeof(int32_t)) ||
+            pwrite(append->fds[FILE_VALUE], ints + count, count * sizeof(int32_t), row * sizeof(int32_t)) != (ssize_t)(count * sizeof(int32_t)) ||
+            pwrite(append->fds[FILE_LATITUDE], floats, count * sizeof(float), row * sizeof(float)) != (ssize_t)(count * sizeof(float)) ||
+            pwrite(append->fds[FILE_LONGITUDE], floats + count, count * sizeof(float), row * sizeof(float)) != (ssize_t)(count * sizeof(float)) ||
+            pwrite(append->fds[FILE_USERNAME_OFFSETS], offsets, count * sizeof(uint64_t), row * sizeof(uint64_t)) != (ssize_t)(count * sizeof(uint64_t)) ||
+            pwrite(append->fds[FILE_CLUE_OFFSETS], offsets + count, count * sizeof(uint64_t), row * sizeof(uint64_t)) != (ssize_t)(count * sizeof(uint64_t)) ||
+            pwrite(append->fds[FILE_USERNAME_HEAP], usernames, usernames_len, header->username_heap_size) != (ssize_t)usernames_len ||
+            pwrite(append->fds[FILE_CLUE_HEAP], clues, clues_len, header->clue_heap_size) != (ssize_t)clues_len ||
+            pwrite(append->fds[FILE_ACTIVE], active, active_len, row / 8) != (ssize_t)active_len) {
+            perror("Failed to append to columns");
+        } else {
+            header->row_count += count;
+            header->username_heap_size += usernames_len;
+            header->clue_heap_size += clues_len;
+            append->last_active = (header->row_count % 8 != 0) ? active[active_len - 1] : 0;
+            result = 0;
+        }
+    }
+    
+    free(ints);
+    free(floats);
+    free(offsets);
+    free(usernames);
+    free(clues);
+    free(active);
+    return result;
+}
+
+// Publish the appended rows under the hunt's current meta generation
+void columns_finish_append(ColumnAppend *append, const char *hunt_id) {
+    HuntMeta meta;
+    
+    if (read_hunt_meta(hunt_id, &meta) == 0) {
+        append->header.generation = meta.generation;
+        if (pwrite(append->header_fd, &append->header, sizeof(ColumnsHeader), 0) !=
+            sizeof(ColumnsHeader)) {
+            perror("Failed to update columns header");
+        }
+    }
+    
+    columns_abort_append(append);
+}
+
+// Close the appender without publishing anything
+void columns_abort_append(ColumnAppend *append) {
+    if (append->header_fd != -1) {
+        close(append->header_fd);
+        append->header_fd = -1;
+    }
+    for (int i = 0; i < COLUMN_FILE_COUNT; i++) {
+        if (append->fds[i] != -1) {
+            close(append->fds[i]);
+            append->fds[i] = -1;
+        }
+    }
+}
+
+// Clear the active bit of a removed treasure and move the columns from
+// generation to new_generation. Stale columns are dropped instead.
+void columns_record_removed(const char *hunt_id, int treasure_id, uint64_t generation,
+                            uint64_t new_generation) {
+    ColumnsHeader header;
+    ColumnSet set;
+    int64_t row;
+    uint8_t active_byte;
+    int fd, header_fd;
+    
+    if (read_columns_header(hunt_id, &header) == -1) {
+        return;
+    }
+    if (header.generation != generation) {
+        remove_columns(hunt_id);
+        return;
+    }
+    
+    // Find the row through the ID column (the meta block has already moved
+    // on, so columns_open() would consider the set stale)
+    memset(&set, 0, sizeof(set));
+    set.header = header;
+    row = -1;
+    fd = open(column_file_path(hunt_id, "id.col"), O_RDONLY);
+    if (fd != -1 && header.row_count > 0) {
+        size_t len = header.row_count * sizeof(int32_t);
+        void *ids = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        int active_fd = open(column_file_path(hunt_id, "active.col"), O_RDONLY);
+        size_t active_len = (header.row_count + 7) / 8;
+        void *active = active_fd == -1 ? MAP_FAILED :
+                       mmap(NULL, active_len, PROT_READ, MAP_PRIVATE, active_fd, 0);
+        
+        if (ids != MAP_FAILED && active != MAP_FAILED) {
+            set.ids = ids;
+            set.active = active;
+            row = columns_find_row(&set, treasure_id);
+        }
+        if (ids != MAP_FAILED) {
+            munmap(ids, len);
+        }
+        if (active != MAP_FAILED) {
+            munmap(active, active_len);
+        }
+        if (active_fd != -1) {
+            close(active_fd);
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    
+    fd = open(column_file_path(hunt_id, "active.col"), O_RDWR);
+    header_fd = open(column_file_path(hunt_id, "header"), O_WRONLY);
+    if (row == -1 || fd == -1 || header_fd == -1 ||
+        pread(fd, &active_byte, 1, row / 8) != 1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        if (header_fd != -1) {
+            close(header_fd);
+        }
+        remove_columns(hunt_id);
+        return;
+    }
+    
+    active_byte &= ~(1u << (row % 8));
+    header.generation = new_generation;
+    if (pwrite(fd, &active_byte, 1, row / 8) != 1 ||
+        pwrite(header_fd, &header, sizeof(header), 0) != sizeof(header)) {
+        perror("Failed to update columns");
+        close(fd);
+        close(header_fd);
+        remove_columns(hunt_id);
+        return;
+    }
+    
+    close(fd);
+    close(header_fd);
+}
@@ -0,0 +1,85 @@
+#ifndef TREASURE_COLUMNS_H
+#define TREASURE_COLUMNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "treasure_store.h"
+
+#define COLUMNS_MAGIC 0x4C4F4354    // "TCOL"
+#define COLUMNS_VERSION 1
+#define COLUMNS_IDS_SORTED 0x1u     // Header flag: the ID column is ascending
+
+// Columns of the optional structure-of-arrays layout (hunts/<id>/columns/).
+// Each bit selects one file to map in columns_open().
+#define COLUMN_ID        0x01u      // id.col: int32 per row
+#define COLUMN_VALUE     0x02u      // value.col: int32 per row
+#define COLUMN_LOCATION  0x04u      // latitude.col, longitude.col: float per row
+#define COLUMN_ACTIVE    0x08u      // active.col: one bit per row
+#define COLUMN_USERNAME  0x10u      // username.off: uint64 per row into username.heap
+#define COLUMN_CLUE      0x20u      // clue.off: uint64 per row into clue.heap
+#define COLUMN_ALL       0x3Fu
+#define COLUMN_FILE_COUNT 9       // Column and heap files besides the header
+
+// Header of the columnar layout (columns/header). Like scores.dat it is
+// stamped with the meta generation it matches: add and remove update the
+// columns in the same operation, and readers fall back to treasures.dat
+// when the generation is stale. Rows past row_count (or heap bytes past
+// the heap sizes) are leftovers of an interrupted append and are ignored.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+    int64_t row_count;
+    int64_t username_heap_size;
+    int64_t clue_heap_size;
+    uint32_t flags;
+    uint32_t reserved;
+} ColumnsHeader;
+
+// Read-only view of the columns selected when it was opened. Strings are
+// NUL-terminated inside their heap.
+typedef struct {
+    ColumnsHeader header;
+    const int32_t *ids;
+    const int32_t *values;
+    const float *latitudes;
+    const float *longitudes;
+    const uint8_t *active;
+    const uint64_t *username_offsets;
+    const char *username_heap;
+    const uint64_t *clue_offsets;
+    const char *clue_heap;
+    void *maps[COLUMN_FILE_COUNT];
+    size_t map_lens[COLUMN_FILE_COUNT];
+} ColumnSet;
+
+// Open appender: column files positioned after the last valid row
+typedef struct {
+    ColumnsHeader header;
+    int header_fd;
+    int fds[COLUMN_FILE_COUNT];
+    int last_id;                   // ID of the last row, to keep track of the sort order
+    uint8_t last_active;           // Partially filled last byte of active.col
+} ColumnAppend;
+
+#define COLUMN_ROW_ACTIVE(set, row) (((set)->active[(row) / 8] >> ((row) % 8)) & 1)
+
+// Function prototypes
+char* get_columns_dir_path(const char *hunt_id);
+int convert_to_columns(const char *hunt_id);
+int columns_exist(const char *hunt_id);
+void remove_columns(const char *hunt_id);
+int columns_open(const char *hunt_id, uint32_t wanted, ColumnSet *set);
+void columns_close(ColumnSet *set);
+int64_t columns_find_row(const ColumnSet *set, int treasure_id);
+void columns_get_treasure(const ColumnSet *set, int64_t row, Treasure *treasure);
+int columns_begin_append(const char *hunt_id, uint64_t generation, ColumnAppend *append);
+int columns_append(ColumnAppend *append, const Treasure *records, size_t count);
+void columns_finish_append(ColumnAppend *append, const char *hunt_id);
+void columns_abort_append(ColumnAppend *append);
+void columns_record_removed(const char *hunt_id, int treasure_id, uint64_t generation,
+                            uint64_t new_generation);
+
+#endif
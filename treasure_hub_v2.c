@@ -1,3 +1,5 @@
+#define _DEFAULT_SOURCE  // sigaction, sysconf(_SC_NPROCESSORS_ONLN)
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,98 +11,215 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <sys/uio.h>
+#include <poll.h>
+
+#include "monitor_protocol.h"
+#include "outbuf.h"
+#include "score_table.h"
 
 #define MAX_CMD_LEN 256
 #define MAX_BUFFER_SIZE 4096
-#define COMMAND_FILE "monitor_command.txt"
-#define PARAM_FILE "monitor_params.txt"
 #define HUNTS_DIR "./hunts"
+#define MAX_SCORE_WORKERS 64
+#define DEFAULT_LEADERBOARD_SIZE 10
+#define RESPONSE_BUFFER_SIZE (2 * (sizeof(MonitorResponseHeader) + MONITOR_MAX_DATA))
 
 // Global variables
 pid_t monitor_pid = -1;
 volatile sig_atomic_t monitor_exiting = 0;
 volatile sig_atomic_t child_exited = 0;
 int exit_status = 0;
-int pipe_fd[2]; // Pipe for monitor to send back results
+int request_fd = -1;     // Requests to the monitor
+int response_fd = -1;    // Responses from the monitor
+uint32_t next_request_id = 1;
+char response_buffer[RESPONSE_BUFFER_SIZE];
+size_t response_buffer_len = 0;
+
+// One hunt being scored by the score calculator worker pool
+typedef struct {
+    char hunt_id[MAX_CMD_LEN];
+    pid_t pid;
+    int fd;                 // Read end of the calculator's stdout, -1 when done
+    char *output;           // Everything the calculator printed
+    size_t len;
+    size_t capacity;
+    bool finished;
+} ScoreJob;
 
 // Function prototypes
 void handle_sigchld(int sig);
-void send_command_to_monitor(const char *command, const char *params);
+uint32_t send_command_to_monitor(uint16_t command, const char *arg1, const char *arg2);
 void start_monitor();
 void list_hunts();
 void list_treasures(const char *hunt_id);
 void view_treasure(const char *hunt_id, const char *treasure_id);
 void stop_monitor();
-void calculate_score();
+void calculate_score(int workers);
 void process_command(char *cmd);
 void trim_newline(char *str);
-void read_monitor_output();
-void launch_score_calculator(const char *hunt_id);
+void read_monitor_output(uint32_t request_id);
+void close_monitor_pipes();
+pid_t launch_score_calculator(const char *hunt_id, const char *option, const char *option_value,
+                              int *output_fd);
+void leaderboard(const char *hunt_id, int top);
+int compare_score_jobs(const void *a, const void *b);
+int read_score_output(ScoreJob *job);
+ScoreJob* collect_score_jobs(int *job_count);
+int run_score_jobs(ScoreJob *jobs, int job_count, int workers, const char *option,
+                   void (*finished)(ScoreJob *job, void *context), void *context);
+void print_hunt_scores(ScoreJob *job, void *context);
+void merge_hunt_scores(ScoreJob *job, void *context);
+int compare_user_scores(const void *a, const void *b);
+void global_score(int workers);
 
 // Signal handler for SIGCHLD
-void handle_sigchld() {
+void handle_sigchld(int sig) {
     int status;
-    pid_t pid;
     
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        if (pid == monitor_pid) {
-            child_exited = 1;
-            if (WIFEXITED(status)) {
-                exit_status = WEXITSTATUS(status);
-            } else if (WIFSIGNALED(status)) {
-                exit_status = 128 + WTERMSIG(status);
-            }
-            monitor_pid = -1;
-            
-            // Close pipe when monitor exits
-            close(pipe_fd[0]);
+    (void)sig;
+    
+    // Only reap the monitor: score calculators are waited for by
+    // the code that started them
+    if (monitor_pid > 0 && waitpid(monitor_pid, &status, WNOHANG) > 0) {
+        child_exited = 1;
+        if (WIFEXITED(status)) {
+            exit_status = WEXITSTATUS(status);
+        } else if (WIFSIGNALED(status)) {
+            exit_status = 128 + WTERMSIG(status);
         }
+        monitor_pid = -1;
     }
 }
 
 
-void send_command_to_monitor(const char *command, const char *params) {
-    FILE *cmd_file = fopen(COMMAND_FILE, "w");
-    if (cmd_file) {
-        fprintf(cmd_file, "%s", command);
-        fclose(cmd_file);
-    } else {
-        perror("Failed to write command file");
+/* Send one request frame to the monitor. The arguments are packed into
+   the payload as NUL-separated strings. Returns the request ID, 0 on error */
+uint32_t send_command_to_monitor(uint16_t command, const char *arg1, const char *arg2) {
+    MonitorRequestHeader header;
+    struct iovec frame[3];
+    int count = 1;
+    
+    memset(&header, 0, sizeof(header));
+    header.request_id = next_request_id++;
+    header.command = command;
+    
+    frame[0].iov_base = &header;
+    frame[0].iov_len = sizeof(header);
+    if (arg1) {
+        frame[count].iov_base = (void *)arg1;
+        frame[count].iov_len = strlen(arg1) + 1;
+        header.length += frame[count++].iov_len;
+    }
+    if (arg2) {
+        frame[count].iov_base = (void *)arg2;
+        frame[count].iov_len = strlen(arg2) + 1;
+        header.length += frame[count++].iov_len;
     }
     
-    if (params) {
-        FILE *param_file = fopen(PARAM_FILE, "w");
-        if (param_file) {
-            fprintf(param_file, "%s", params);
-            fclose(param_file);
-        } else {
-            perror("Failed to write params file");
-        }
+    if (header.length > MONITOR_MAX_PAYLOAD) {
+        printf("Error: Command arguments are too long\n");
+        return 0;
     }
     
-    /* Notify monitor about the new command */
-    if (monitor_pid > 0) {
-        kill(monitor_pid, SIGUSR1);
+    if (outbuf_writev_all(request_fd, frame, count) == -1) {
+        perror("Failed to send command to monitor");
+        return 0;
     }
+    
+    return header.request_id;
 }
 
 
-void read_monitor_output() {
-    char buffer[MAX_BUFFER_SIZE];
+/* Wait for the response to a request and stream its DATA frames to the
+   terminal as they arrive. Returns once the END frame with this request ID
+   has been read, or the monitor has closed its end of the pipe */
+void read_monitor_output(uint32_t request_id) {
+    struct pollfd pfd;
     ssize_t bytes_read;
+    size_t offset;
+    bool done = false;
+    OutBuf out;
     
-    // Set pipe to non-blocking
-    int flags = fcntl(pipe_fd[0], F_GETFL, 0);
-    fcntl(pipe_fd[0], F_SETFL, flags | O_NONBLOCK);
+    if (request_id == 0 || response_fd == -1) {
+        return;
+    }
     
-    // Allow some time for data to arrive
-    usleep(100000); // 0.1 seconds
+    pfd.fd = response_fd;
+    pfd.events = POLLIN;
     
-    // Read from the pipe
-    while ((bytes_read = read(pipe_fd[0], buffer, sizeof(buffer) - 1)) > 0) {
-        buffer[bytes_read] = '\0';
-        printf("%s", buffer);
+    outbuf_init(&out, STDOUT_FILENO);
+    while (!done) {
+        if (poll(&pfd, 1, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll failed");
+            break;
+        }
+        
+        bytes_read = read(response_fd, response_buffer + response_buffer_len,
+                          sizeof(response_buffer) - response_buffer_len);
+        if (bytes_read == -1) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            perror("Failed to read monitor response");
+            break;
+        }
+        if (bytes_read == 0) {
+            printf("Error: Monitor closed the connection\n");
+            break;
+        }
+        response_buffer_len += bytes_read;
+        
+        // Pass on every complete frame in the buffer
+        offset = 0;
+        while (!done && response_buffer_len - offset >= sizeof(MonitorResponseHeader)) {
+            MonitorResponseHeader header;
+            
+            memcpy(&header, response_buffer + offset, sizeof(header));
+            if (response_buffer_len - offset < sizeof(header) + header.length) {
+                break;
+            }
+            // Output of an earlier request whose read gave up early is not ours
+            if (header.request_id != request_id) {
+                offset += sizeof(header) + header.length;
+                continue;
+            }
+            if (header.type == MONITOR_RESPONSE_DATA) {
+                outbuf_write(&out, response_buffer + offset + sizeof(header), header.length);
+            } else if (header.type == MONITOR_RESPONSE_END) {
+                if (header.status != MONITOR_STATUS_OK) {
+                    outbuf_printf(&out, "Monitor reported an error for this command\n");
+                }
+                done = true;
+            }
+            offset += sizeof(header) + header.length;
+        }
+        
+        // Keep a partial frame for the next read
+        memmove(response_buffer, response_buffer + offset, response_buffer_len - offset);
+        response_buffer_len -= offset;
+        
+        // Show what has arrived so far before waiting for more
+        outbuf_flush(&out);
     }
+    outbuf_flush(&out);
+}
+
+
+/* Close the hub's ends of the monitor pipes once the monitor has exited */
+void close_monitor_pipes() {
+    if (request_fd != -1) {
+        close(request_fd);
+        request_fd = -1;
+    }
+    if (response_fd != -1) {
+        close(response_fd);
+        response_fd = -1;
+    }
+    response_buffer_len = 0;
 }
 
 
@@ -110,39 +229,54 @@ void start_monitor() {
         return;
     }
     
-    // Create pipe for monitor to hub communication
-    if (pipe(pipe_fd) == -1) {
+    int request_pipe[2];    // Hub -> monitor
+    int response_pipe[2];   // Monitor -> hub
+    
+    if (pipe(request_pipe) == -1) {
+        perror("Failed to create pipe");
+        return;
+    }
+    if (pipe(response_pipe) == -1) {
         perror("Failed to create pipe");
+        close(request_pipe[0]);
+        close(request_pipe[1]);
         return;
     }
     
     pid_t pid = fork();
     if (pid < 0) {
         perror("Fork failed");
-        close(pipe_fd[0]);
-        close(pipe_fd[1]);
+        close(request_pipe[0]);
+        close(request_pipe[1]);
+        close(response_pipe[0]);
+        close(response_pipe[1]);
     } else if (pid == 0) {
         /* Child process - execute the monitor program */
-        close(pipe_fd[0]); // Close read end
+        close(request_pipe[1]);   // Close the hub's ends
+        close(response_pipe[0]);
         
-        // Duplicate the write end to stdout
-        if (dup2(pipe_fd[1], STDOUT_FILENO) == -1) {
-            perror("dup2 failed");
-            exit(EXIT_FAILURE);
-        }
-        
-        close(pipe_fd[1]); // Close original write end
+        // Keep SIGTERM blocked across exec: a stop signal sent before the
+        // monitor has set up its signalfd stays pending instead of killing it
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        sigprocmask(SIG_BLOCK, &mask, NULL);
         
-        // Pass pipe fd as argument to monitor
-        char pipe_fd_str[16];
-        snprintf(pipe_fd_str, sizeof(pipe_fd_str), "%d", pipe_fd[1]);
+        // Pass both pipe fds as arguments to the monitor
+        char request_fd_str[16];
+        char response_fd_str[16];
+        snprintf(request_fd_str, sizeof(request_fd_str), "%d", request_pipe[0]);
+        snprintf(response_fd_str, sizeof(response_fd_str), "%d", response_pipe[1]);
         
-        execl("./treasure_monitor", "treasure_monitor", pipe_fd_str, NULL);
+        execl("./treasure_monitor", "treasure_monitor", request_fd_str, response_fd_str, NULL);
         perror("Exec failed");
         exit(EXIT_FAILURE);
     } else {
         /* Parent process */
-        close(pipe_fd[1]); // Close write end
+        close(request_pipe[0]);   // Close the monitor's ends
+        close(response_pipe[1]);
+        request_fd = request_pipe[1];
+        response_fd = response_pipe[0];
         monitor_pid = pid;
         printf("Monitor started with PID: %d\n", monitor_pid);
     }
@@ -161,8 +295,7 @@ void list_hunts() {
         return;
     }
     
-    send_command_to_monitor("list_hunts", NULL);
-    read_monitor_output();
+    read_monitor_output(send_command_to_monitor(MONITOR_CMD_LIST_HUNTS, NULL, NULL));
 }
 
 
@@ -178,8 +311,7 @@ void list_treasures(const char *hunt_id) {
         return;
     }
     
-    send_command_to_monitor("list_treasures", hunt_id);
-    read_monitor_output();
+    read_monitor_output(send_command_to_monitor(MONITOR_CMD_LIST_TREASURES, hunt_id, NULL));
 }
 
 // Send view_treasure command to the monitor
@@ -194,10 +326,7 @@ void view_treasure(const char *hunt_id, const char *treasure_id) {
         return;
     }
     
-    char params[MAX_CMD_LEN];
-    snprintf(params, sizeof(params), "%s %s", hunt_id, treasure_id);
-    send_command_to_monitor("view_treasure", params);
-    read_monitor_output();
+    read_monitor_output(send_command_to_monitor(MONITOR_CMD_VIEW_TREASURE, hunt_id, treasure_id));
 }
 
 
@@ -214,96 +343,406 @@ void stop_monitor() {
     }
     
     monitor_exiting = 1;
-    send_command_to_monitor("stop", NULL);
-    read_monitor_output();
+    read_monitor_output(send_command_to_monitor(MONITOR_CMD_STOP, NULL, NULL));
     printf("Stopping monitor...\n");
 }
 
 
-void launch_score_calculator(const char *hunt_id) {
+/* Start a score calculator for one hunt, passing option (and its value)
+   first when not NULL. Returns its PID and the read end of its stdout in
+   output_fd, or -1 on error */
+pid_t launch_score_calculator(const char *hunt_id, const char *option, const char *option_value,
+                              int *output_fd) {
     int score_pipe[2];
     pid_t score_pid;
-    
+
     if (pipe(score_pipe) == -1) {
         perror("Failed to create score pipe");
-        return;
+        return -1;
     }
-    
+
     score_pid = fork();
     if (score_pid < 0) {
         perror("Score calculator fork failed");
         close(score_pipe[0]);
         close(score_pipe[1]);
+        return -1;
     } else if (score_pid == 0) {
         /* Child process - execute the score calculator */
         close(score_pipe[0]); // Close read end
-        
+
         // Redirect stdout to the pipe
         if (dup2(score_pipe[1], STDOUT_FILENO) == -1) {
             perror("Score calculator dup2 failed");
             exit(EXIT_FAILURE);
         }
-        
+
         close(score_pipe[1]); // Close original write end
-        
+
+        // Keep the calculator away from the hub's terminal input
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd != -1) {
+            dup2(null_fd, STDIN_FILENO);
+            close(null_fd);
+        }
+
         // Execute the score calculator with hunt_id as parameter
-        execl("./score_calculator", "score_calculator", hunt_id, NULL);
+        if (option && option_value) {
+            execl("./score_calculator", "score_calculator", option, option_value, hunt_id, NULL);
+        } else if (option) {
+            execl("./score_calculator", "score_calculator", option, hunt_id, NULL);
+        } else {
+            execl("./score_calculator", "score_calculator", hunt_id, NULL);
+        }
         perror("Score calculator exec failed");
         exit(EXIT_FAILURE);
-    } else {
-        /* Parent process */
-        close(score_pipe[1]); // Close write end
-        
-        // Read from the pipe
-        char buffer[MAX_BUFFER_SIZE];
-        ssize_t bytes_read;
-        
-        // Read and output the score results
-        bytes_read = read(score_pipe[0], buffer, sizeof(buffer) - 1);
-        if (bytes_read > 0) {
-            buffer[bytes_read] = '\0';
-            printf("Scores for hunt '%s':\n", hunt_id);
-            printf("%s", buffer);
+    }
+
+    /* Parent process */
+    close(score_pipe[1]); // Close write end
+    *output_fd = score_pipe[0];
+    return score_pid;
+}
+
+
+int compare_score_jobs(const void *a, const void *b) {
+    return strcmp(((const ScoreJob *)a)->hunt_id, ((const ScoreJob *)b)->hunt_id);
+}
+
+
+/* Read what is available from a running calculator. Returns 0 once its
+   output is complete */
+int read_score_output(ScoreJob *job) {
+    char buffer[MAX_BUFFER_SIZE];
+    ssize_t bytes_read;
+
+    bytes_read = read(job->fd, buffer, sizeof(buffer));
+    if (bytes_read == -1 && errno == EINTR) {
+        return 1;
+    }
+    if (bytes_read <= 0) {
+        if (bytes_read == -1) {
+            perror("Failed to read score output");
         }
-        
-        close(score_pipe[0]);
-        
-        // Wait for the score calculator to finish
-        int status;
-        waitpid(score_pid, &status, 0);
+        return 0;
     }
+
+    if (job->len + bytes_read > job->capacity) {
+        size_t capacity = job->capacity ? job->capacity * 2 : MAX_BUFFER_SIZE;
+        while (capacity < job->len + bytes_read) {
+            capacity *= 2;
+        }
+        char *output = realloc(job->output, capacity);
+        if (!output) {
+            perror("Failed to allocate score output");
+            return 0;
+        }
+        job->output = output;
+        job->capacity = capacity;
+    }
+    memcpy(job->output + job->len, buffer, bytes_read);
+    job->len += bytes_read;
+
+    return 1;
 }
 
 
-void calculate_score() {
+/* Make a list of the hunts under HUNTS_DIR sorted by name. Returns the
+   jobs (to be freed by the caller) and their number in job_count, or NULL
+   on error */
+ScoreJob* collect_score_jobs(int *job_count) {
     DIR *dir;
     struct dirent *entry;
-    char hunt_id[MAX_CMD_LEN];
-    
+    ScoreJob *jobs = NULL;
+    int job_capacity = 0;
+
+    *job_count = 0;
     dir = opendir(HUNTS_DIR);
     if (!dir) {
         perror("Failed to open hunts directory");
-        return;
+        return NULL;
     }
-    
-    printf("Calculating scores for all hunts...\n");
-    
-    // For each hunt directory, launch a score calculator
+
     while ((entry = readdir(dir)) != NULL) {
         // Skip . and .. directories
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
             continue;
         }
-        
-        // Launch score calculator for this hunt
-        strcpy(hunt_id, entry->d_name);
-        launch_score_calculator(hunt_id);
+
+        if (*job_count == job_capacity) {
+            job_capacity = job_capacity ? job_capacity * 2 : 16;
+            ScoreJob *grown = realloc(jobs, job_capacity * sizeof(ScoreJob));
+            if (!grown) {
+                perror("Failed to allocate score jobs");
+                free(jobs);
+                closedir(dir);
+                return NULL;
+            }
+            jobs = grown;
+        }
+
+        memset(&jobs[*job_count], 0, sizeof(ScoreJob));
+        snprintf(jobs[*job_count].hunt_id, sizeof(jobs[*job_count].hunt_id), "%s", entry->d_name);
+        jobs[*job_count].fd = -1;
+        (*job_count)++;
     }
-    
     closedir(dir);
+
+    if (*job_count > 0) {
+        qsort(jobs, *job_count, sizeof(ScoreJob), compare_score_jobs);
+    } else {
+        // No hunts: an empty list rather than an error
+        jobs = malloc(sizeof(ScoreJob));
+    }
+
+    return jobs;
+}
+
+
+/* Run a score calculator (with the given option) for every job, keeping
+   up to 'workers' of them running at once (0 = one per CPU core). The
+   result pipes are multiplexed with poll, and finished() gets each job's
+   complete output in job order, as soon as all earlier jobs are done.
+   Returns 0 on success, -1 if the pool had to be stopped early */
+int run_score_jobs(ScoreJob *jobs, int job_count, int workers, const char *option,
+                   void (*finished)(ScoreJob *job, void *context), void *context) {
+    struct pollfd fds[MAX_SCORE_WORKERS];
+    int running[MAX_SCORE_WORKERS];
+    int next_job = 0, next_done = 0;
+    nfds_t active = 0;              // Running jobs, first in running[] and fds[]
+    int result = 0;
+
+    if (workers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (int)cores : 1;
+    }
+    if (workers > MAX_SCORE_WORKERS) {
+        workers = MAX_SCORE_WORKERS;
+    }
+
+    while (next_done < job_count) {
+        // Keep the pool full
+        while (active < (nfds_t)workers && next_job < job_count) {
+            ScoreJob *job = &jobs[next_job++];
+
+            job->pid = launch_score_calculator(job->hunt_id, option, NULL, &job->fd);
+            if (job->pid == -1) {
+                job->finished = true;
+                continue;
+            }
+            running[active++] = job - jobs;
+        }
+
+        // Hand on finished results that are next in order
+        while (next_done < job_count && jobs[next_done].finished) {
+            ScoreJob *job = &jobs[next_done++];
+
+            finished(job, context);
+            free(job->output);
+            job->output = NULL;
+        }
+
+        if (active == 0) {
+            continue;
+        }
+
+        for (nfds_t i = 0; i < active; i++) {
+            fds[i].fd = jobs[running[i]].fd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+
+        if (poll(fds, active, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll failed");
+            result = -1;
+            break;
+        }
+
+        for (int i = (int)active - 1; i >= 0; i--) {
+            ScoreJob *job = &jobs[running[i]];
+
+            if (fds[i].revents == 0 || read_score_output(job)) {
+                continue;
+            }
+
+            // Output complete: reap the calculator and free its slot
+            close(job->fd);
+            job->fd = -1;
+            waitpid(job->pid, NULL, 0);
+            job->finished = true;
+            running[i] = running[--active];
+        }
+    }
+
+    // Only reached early on a poll error: stop what is still running
+    for (nfds_t i = 0; i < active; i++) {
+        ScoreJob *job = &jobs[running[i]];
+        close(job->fd);
+        kill(job->pid, SIGTERM);
+        waitpid(job->pid, NULL, 0);
+    }
+    for (int i = 0; i < job_count; i++) {
+        free(jobs[i].output);
+        jobs[i].output = NULL;
+    }
+
+    return result;
+}
+
+
+/* Print one hunt's scores */
+void print_hunt_scores(ScoreJob *job, void *context) {
+    OutBuf *out = context;
+
+    if (job->len > 0) {
+        outbuf_printf(out, "Scores for hunt '%s':\n", job->hunt_id);
+        outbuf_write(out, job->output, job->len);
+    }
+    outbuf_flush(out);
+}
+
+
+/* Score every hunt with up to 'workers' calculators running at once. The
+   results are printed in hunt name order */
+void calculate_score(int workers) {
+    ScoreJob *jobs;
+    int job_count;
+    OutBuf out;
+
+    jobs = collect_score_jobs(&job_count);
+    if (!jobs) {
+        return;
+    }
+
+    printf("Calculating scores for all hunts...\n");
+    outbuf_init(&out, STDOUT_FILENO);
+    run_score_jobs(jobs, job_count, workers, NULL, print_hunt_scores, &out);
+    outbuf_flush(&out);
+    free(jobs);
+
     printf("Score calculation complete.\n");
 }
 
+
+/* Add one hunt's per-user partial totals (binary ScoreEntry records) to
+   the global table */
+void merge_hunt_scores(ScoreJob *job, void *context) {
+    ScoreTable *totals = context;
+    char username[SCORE_NAME_SIZE + 1];
+    ScoreEntry entry;
+
+    for (size_t offset = 0; offset + sizeof(ScoreEntry) <= job->len; offset += sizeof(ScoreEntry)) {
+        memcpy(&entry, job->output + offset, sizeof(ScoreEntry));
+        memcpy(username, entry.username, SCORE_NAME_SIZE);
+        username[SCORE_NAME_SIZE] = '\0';
+        if (score_table_add(totals, username, entry.score, entry.count) == -1) {
+            perror("Failed to allocate global scores");
+            return;
+        }
+    }
+}
+
+
+int compare_user_scores(const void *a, const void *b) {
+    const UserScore *x = *(const UserScore * const *)a;
+    const UserScore *y = *(const UserScore * const *)b;
+
+    if (x->score != y->score) {
+        return x->score < y->score ? 1 : -1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+
+/* Rank users across all hunts. The calculators compute every hunt's
+   per-user partial totals in parallel and send them back as binary
+   entries, which are merged here in a hash table keyed by user name */
+void global_score(int workers) {
+    ScoreJob *jobs;
+    ScoreTable totals;
+    UserScore **ranking;
+    int job_count;
+    OutBuf out;
+
+    jobs = collect_score_jobs(&job_count);
+    if (!jobs) {
+        return;
+    }
+
+    if (score_table_init(&totals) == -1) {
+        perror("Failed to allocate global scores");
+        free(jobs);
+        return;
+    }
+
+    printf("Calculating global scores across %d hunts...\n", job_count);
+    run_score_jobs(jobs, job_count, workers, "--entries", merge_hunt_scores, &totals);
+    free(jobs);
+
+    ranking = malloc((totals.user_count + 1) * sizeof(UserScore *));
+    if (!ranking) {
+        perror("Failed to allocate global scores");
+        score_table_free(&totals);
+        return;
+    }
+    for (size_t i = 0; i < totals.user_count; i++) {
+        ranking[i] = &totals.users[i];
+    }
+    qsort(ranking, totals.user_count, sizeof(UserScore *), compare_user_scores);
+
+    outbuf_init(&out, STDOUT_FILENO);
+    outbuf_printf(&out, "===== GLOBAL SCORES =====\n");
+    for (size_t i = 0; i < totals.user_count; i++) {
+        outbuf_printf(&out, "%zu. %s: %lld points (%lld treasures)\n", i + 1,
+                      ranking[i]->name, ranking[i]->score, ranking[i]->count);
+    }
+    if (totals.user_count == 0) {
+        outbuf_printf(&out, "No users with items found in any hunt.\n");
+    }
+    outbuf_flush(&out);
+
+    free(ranking);
+    score_table_free(&totals);
+}
+
+
+/* Show the best 'top' users of one hunt, passing the calculator's output
+   through as it arrives */
+void leaderboard(const char *hunt_id, int top) {
+    char buffer[MAX_BUFFER_SIZE];
+    ssize_t bytes_read;
+    pid_t score_pid;
+    int fd;
+    OutBuf out;
+    
+    char top_str[16];
+    snprintf(top_str, sizeof(top_str), "%d", top);
+    score_pid = launch_score_calculator(hunt_id, "--top", top_str, &fd);
+    if (score_pid == -1) {
+        return;
+    }
+    
+    printf("Leaderboard for hunt '%s':\n", hunt_id);
+    outbuf_init(&out, STDOUT_FILENO);
+    while ((bytes_read = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to read leaderboard");
+            break;
+        }
+        outbuf_write(&out, buffer, bytes_read);
+    }
+    outbuf_flush(&out);
+    
+    close(fd);
+    waitpid(score_pid, NULL, 0);
+}
+
 /**
  * Remove trailing newline from a string
  */
@@ -345,7 +784,23 @@ void process_command(char *cmd) {
             printf("Error: Missing hunt ID or treasure ID\n");
         }
     } else if (strcmp(token, "calculate_score") == 0) {
-        calculate_score();
+        // Optional worker count, defaults to the number of cores
+        token = strtok(NULL, " ");
+        calculate_score(token ? atoi(token) : 0);
+    } else if (strcmp(token, "global_score") == 0) {
+        // Optional worker count, defaults to the number of cores
+        token = strtok(NULL, " ");
+        global_score(token ? atoi(token) : 0);
+    } else if (strcmp(token, "leaderboard") == 0) {
+        char *hunt_id = strtok(NULL, " ");
+        char *top = strtok(NULL, " ");
+        if (!hunt_id) {
+            printf("Error: Missing hunt ID\n");
+        } else if (top && atoi(top) <= 0) {
+            printf("Error: Leaderboard size must be a positive number\n");
+        } else {
+            leaderboard(hunt_id, top ? atoi(top) : DEFAULT_LEADERBOARD_SIZE);
+        }
     } else if (strcmp(token, "stop_monitor") == 0) {
         stop_monitor();
     } else if (strcmp(token, "exit") == 0) {
@@ -357,7 +812,7 @@ void process_command(char *cmd) {
         }
     } else {
         printf("Unknown command: %s\n", token);
-        printf("Available commands: start_monitor, list_hunts, list_treasures, view_treasure, calculate_score, stop_monitor, exit\n");
+        printf("Available commands: start_monitor, list_hunts, list_treasures, view_treasure, calculate_score, global_score, leaderboard, stop_monitor, exit\n");
     }
 }
 
@@ -372,6 +827,12 @@ int main() {
     sa.sa_flags = SA_RESTART;
     sigaction(SIGCHLD, &sa, NULL);
     
+    /* A monitor that died leaves a closed request pipe: report the
+       write error instead of being killed by SIGPIPE */
+    sa.sa_handler = SIG_IGN;
+    sa.sa_flags = 0;
+    sigaction(SIGPIPE, &sa, NULL);
+    
     printf("Treasure Hunt Hub\n");
     printf("=================\n");
     printf("Type 'start_monitor' to begin\n");
@@ -380,6 +841,7 @@ int main() {
         /* Check if monitor has exited */
         if (child_exited) {
             printf("Monitor has terminated with status %d\n", exit_status);
+            close_monitor_pipes();
             child_exited = 0;
             monitor_exiting = 0;
         }
@@ -1,3 +1,5 @@
+#define _DEFAULT_SOURCE  // getline
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,49 +7,34 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <time.h>
 #include <errno.h>
-#include <dirent.h>
-#include <libgen.h>
+#include <ctype.h>
 
-#define MAX_PATH 256
-#define MAX_USERNAME 64
-#define MAX_CLUE 256
-#define HUNT_DIR_PREFIX "./hunts/"  // Directory prefix for hunts
+#include "treasure_store.h"
+#include "treasure_columns.h"
+#include "spatial_index.h"
+#include "hunt_log.h"
+#include "hunt_journal.h"
 
-// Structure for a treasure record (fixed size)
-typedef struct {
-    int id;                        // Treasure ID
-    char username[MAX_USERNAME];   // User name
-    float latitude;                // GPS latitude
-    float longitude;               // GPS longitude
-    char clue[MAX_CLUE];           // Clue text
-    int value;                     // Value of the treasure
-    char is_active;                // 1 for active or 0 for deleted
-} Treasure;
+#define IMPORT_BATCH_RECORDS 2048   // Records per write() during --import
 
 // Function prototypes
 void add_treasure(const char *hunt_id);
-void list_treasures(const char *hunt_id);
-void view_treasure(const char *hunt_id, int treasure_id);
-void remove_treasure(const char *hunt_id, int treasure_id);
-void remove_hunt(const char *hunt_id);
-void log_operation(const char *hunt_id, const char *operation);
-void create_symlink(const char *hunt_id);
-void ensure_hunt_directory(const char *hunt_id);
-int get_next_treasure_id(const char *hunt_id);
-char* get_treasure_file_path(const char *hunt_id);
-char* get_log_file_path(const char *hunt_id);
-void format_time(time_t time_value, char *buffer);
-void delete_file(const char *filepath);
-void create_link(const char *target, const char *linkpath);
+void import_treasures(const char *hunt_id, const char *source);
+int write_import_batch(const char *hunt_id, int fd, int format, const Treasure *batch, size_t count,
+                       off_t *data_size);
+void set_columnar(const char *hunt_id, int enable);
+int next_csv_field(const char **pos, char *dest, size_t size);
+int parse_csv_treasure(const char *line, Treasure *treasure);
+const char* parse_json_string(const char *p, char *dest, size_t size);
+int parse_json_treasure(const char *line, Treasure *treasure);
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         printf("Format: treasure_manager --<command> [hunt_id] [treasure_id]\n");
         return 1;
     }
-
+    
     // Parse command
     if (strcmp(argv[1], "--add") == 0) {
         if (argc < 3) {
@@ -56,26 +43,36 @@ int main(int argc, char *argv[]) {
         }
         add_treasure(argv[2]);
     } 
+    else if (strcmp(argv[1], "--import") == 0) {
+        if (argc < 4) {
+            printf("Format: treasure_manager --import <hunt_id> <file|->\n");
+            return 1;
+        }
+        import_treasures(argv[2], argv[3]);
+    } 
     else if (strcmp(argv[1], "--list") == 0) {
         if (argc < 3) {
             printf("Format: treasure_manager --list <hunt_id>\n");
             return 1;
         }
-        list_treasures(argv[2]);
+        return list_treasures(argv[2]) == 0 ? 0 : 1;
+    } 
+    else if (strcmp(argv[1], "--list_hunts") == 0) {
+        return list_hunts() == 0 ? 0 : 1;
     } 
     else if (strcmp(argv[1], "--view") == 0) {
         if (argc < 4) {
             printf("Format: treasure_manager --view <hunt_id> <treasure_id>\n");
             return 1;
         }
-        view_treasure(argv[2], atoi(argv[3]));
+        return view_treasure(argv[2], atoi(argv[3])) == 0 ? 0 : 1;
     } 
     else if (strcmp(argv[1], "--remove_treasure") == 0) {
         if (argc < 4) {
             printf("Format: treasure_manager --remove_treasure <hunt_id> <treasure_id>\n");
             return 1;
         }
-        remove_treasure(argv[2], atoi(argv[3]));
+        return remove_treasure(argv[2], atoi(argv[3])) == 0 ? 0 : 1;
     } 
     else if (strcmp(argv[1], "--remove_hunt") == 0) {
         if (argc < 3) {
@@ -84,186 +81,111 @@ int main(int argc, char *argv[]) {
         }
         remove_hunt(argv[2]);
     } 
-    else {
-        printf("Unknown command: %s\n", argv[1]);
-        return 1;
-    }
-
-    return 0;
-}
-
-void format_time(time_t time_value, char *buffer) {
-    struct tm *time_info;
-    time_info = localtime(&time_value);
-    
-    // Format: YYYY-MM-DD HH:MM:SS
-    sprintf(buffer, "%04d-%02d-%02d %02d:%02d:%02d",
-            time_info->tm_year + 1900,
-            time_info->tm_mon + 1,
-            time_info->tm_mday,
-            time_info->tm_hour,
-            time_info->tm_min,
-            time_info->tm_sec);
-}
-
-void delete_file(const char *filepath) {
-    if (remove(filepath) == -1 && errno != ENOENT) {
-        perror("Failed to remove file");
-    }
-}
-
-void create_link(const char *target, const char *linkpath) {
-    // Try to remove existing link if it exists
-    remove(linkpath);
-    
-    // Create the link using a system call to ln -s as an alternative
-    char command[MAX_PATH * 2 + 10];
-    strcpy(command, "ln -s ");
-    strcat(command, target);
-    strcat(command, " ");
-    strcat(command, linkpath);
-    
-    if (system(command) != 0) {
-        perror("Failed to create symbolic link");
-    }
-}
-
-void ensure_hunt_directory(const char *hunt_id) {
-    char hunt_path[MAX_PATH];
-    
-    // Create hunts directory if it doesn't exist
-    mkdir("hunts", 0755);
-    
-    // Construct the hunt directory path
-    strcpy(hunt_path, HUNT_DIR_PREFIX);
-    strcat(hunt_path, hunt_id);
-    
-    // Create hunt directory if it doesn't exist
-    if (mkdir(hunt_path, 0755) == -1) {
-        if (errno != EEXIST) {
-            perror("Failed to create hunt directory");
-            exit(1);
+    else if (strcmp(argv[1], "--compact") == 0) {
+        if (argc != 3 && !(argc == 5 && (strcmp(argv[3], "--threshold") == 0 ||
+                                         strcmp(argv[3], "--auto") == 0))) {
+            printf("Format: treasure_manager --compact <hunt_id> [--threshold <ratio> | --auto <ratio>]\n");
+            return 1;
         }
-    }
-}
-
-// Get the path to the treasure file for a hunt
-char* get_treasure_file_path(const char *hunt_id) {
-    static char file_path[MAX_PATH];
-    
-    strcpy(file_path, HUNT_DIR_PREFIX);
-    strcat(file_path, hunt_id);
-    strcat(file_path, "/treasures.dat");
-    
-    return file_path;
-}
-
-// Get the path to the log file for a hunt
-char* get_log_file_path(const char *hunt_id) {
-    static char log_path[MAX_PATH];
-    
-    strcpy(log_path, HUNT_DIR_PREFIX);
-    strcat(log_path, hunt_id);
-    strcat(log_path, "/logged_hunt");
-    
-    return log_path;
-}
-
-// Create a symbolic link to the log file
-void create_symlink(const char *hunt_id) {
-    char log_path[MAX_PATH];
-    char link_path[MAX_PATH] = "./logged_hunt-";
-    
-    strcpy(log_path, HUNT_DIR_PREFIX);
-    strcat(log_path, hunt_id);
-    strcat(log_path, "/logged_hunt");
-    
-    strcat(link_path, hunt_id);
-    
-    create_link(log_path, link_path);
-}
-
-// Log an operation to the hunt's log file
-void log_operation(const char *hunt_id, const char *operation) {
-    char *log_path = get_log_file_path(hunt_id);
-    int log_fd;
-    time_t now = time(NULL);
-    char time_str[30];
-    char log_entry[512];
-    
-    // Format the current time
-    format_time(now, time_str);
-    
-    // Format the log entry
-    strcpy(log_entry, "[");
-    strcat(log_entry, time_str);
-    strcat(log_entry, "] ");
-    strcat(log_entry, operation);
-    strcat(log_entry, "\n");
-    
-    // Open log file in append mode, or create if it doesn't exist
-    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (log_fd == -1) {
-        perror("Failed to open log file");
-        return;
-    }
-    
-    // Write log entry
-    if (write(log_fd, log_entry, strlen(log_entry)) == -1) {
-        perror("Failed to write to log file");
-    }
-    
-    close(log_fd);
-    
-    // Create or update symbolic link
-    create_symlink(hunt_id);
-}
-
-// Get the next available treasure ID
-int get_next_treasure_id(const char *hunt_id) {
-    char *file_path = get_treasure_file_path(hunt_id);
-    int fd, max_id = 0;
-    Treasure treasure;
-    
-    fd = open(file_path, O_RDONLY);
-    if (fd == -1) {
-        // If file doesn't exist, start with ID 1
-        if (errno == ENOENT) {
+        if (argc == 3) {
+            compact_hunt(argv[2], 0.0);
+        } else if (strcmp(argv[3], "--threshold") == 0) {
+            compact_hunt(argv[2], atof(argv[4]));
+        } else {
+            set_auto_compact(argv[2], atof(argv[4]));
+        }
+    } 
+    else if (strcmp(argv[1], "--columnar") == 0) {
+        if (argc != 3 && !(argc == 4 && strcmp(argv[3], "--off") == 0)) {
+            printf("Format: treasure_manager --columnar <hunt_id> [--off]\n");
             return 1;
         }
-        perror("Failed to open treasure file");
-        exit(1);
-    }
-    
-    // Read all treasures to find the highest ID
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (treasure.is_active && treasure.id > max_id) {
-            max_id = treasure.id;
+        set_columnar(argv[2], argc == 3);
+    } 
+    else if (strcmp(argv[1], "--journal") == 0) {
+        if (argc != 3 && !(argc == 4 && strcmp(argv[3], "--off") == 0)) {
+            printf("Format: treasure_manager --journal <hunt_id> [--off]\n");
+            return 1;
+        }
+        set_journaled(argv[2], argc == 3);
+    } 
+    else if (strcmp(argv[1], "--log_sync") == 0) {
+        if (argc != 4) {
+            printf("Format: treasure_manager --log_sync <hunt_id> <none|batch|always>\n");
+            return 1;
+        }
+        set_log_sync(argv[2], argv[3]);
+    } 
+    else if (strcmp(argv[1], "--log_format") == 0) {
+        if (argc != 4) {
+            printf("Format: treasure_manager --log_format <hunt_id> <text|binary>\n");
+            return 1;
+        }
+        set_log_format(argv[2], argv[3]);
+    } 
+    else if (strcmp(argv[1], "--log_query") == 0 || strcmp(argv[1], "--log_export") == 0) {
+        time_t since = 0;
+        time_t until = (time_t)LOG_TIME_MAX;
+        int i;
+        
+        for (i = 3; strcmp(argv[1], "--log_query") == 0 && i + 1 < argc; i += 2) {
+            if (strcmp(argv[i], "--since") == 0 && parse_log_time(argv[i + 1], &since) == 0) {
+                continue;
+            }
+            if (strcmp(argv[i], "--until") == 0 && parse_log_time(argv[i + 1], &until) == 0) {
+                continue;
+            }
+            break;
         }
+        if (argc < 3 || i != argc) {
+            printf("Format: treasure_manager --log_query <hunt_id> [--since <time>] [--until <time>]\n");
+            printf("        treasure_manager --log_export <hunt_id>\n");
+            printf("Times are seconds since the epoch or local \"YYYY-MM-DD HH:MM:SS\".\n");
+            return 1;
+        }
+        return query_log(argv[2], since, until) == 0 ? 0 : 1;
+    } 
+    else if (strcmp(argv[1], "--near") == 0) {
+        if (argc != 6 || atof(argv[5]) < 0) {
+            printf("Format: treasure_manager --near <hunt_id> <latitude> <longitude> <radius_km>\n");
+            return 1;
+        }
+        return near_treasures(argv[2], atof(argv[3]), atof(argv[4]), atof(argv[5])) == 0 ? 0 : 1;
+    } 
+    else if (strcmp(argv[1], "--bbox") == 0) {
+        if (argc != 7) {
+            printf("Format: treasure_manager --bbox <hunt_id> <min_lat> <min_lon> <max_lat> <max_lon>\n");
+            return 1;
+        }
+        return bbox_treasures(argv[2], atof(argv[3]), atof(argv[4]), atof(argv[5]), atof(argv[6])) == 0 ? 0 : 1;
+    } 
+    else if (strcmp(argv[1], "--nearest") == 0) {
+        if (argc != 6 || atoi(argv[5]) <= 0) {
+            printf("Format: treasure_manager --nearest <hunt_id> <latitude> <longitude> <k>\n");
+            return 1;
+        }
+        return nearest_treasures(argv[2], atof(argv[3]), atof(argv[4]), atoi(argv[5])) == 0 ? 0 : 1;
+    } 
+    else {
+        printf("Unknown command: %s\n", argv[1]);
+        return 1;
     }
     
-    close(fd);
-    return max_id + 1;
+    return 0;
 }
 
 // Add a new treasure to a hunt
 void add_treasure(const char *hunt_id) {
     Treasure new_treasure;
-    char *file_path;
-    int fd;
-    char log_message[256];
-    
-    // Ensure the hunt directory exists
-    ensure_hunt_directory(hunt_id);
-    
-    // Get the file path
-    file_path = get_treasure_file_path(hunt_id);
-    
-    // Get the next available ID
-    new_treasure.id = get_next_treasure_id(hunt_id);
-    new_treasure.is_active = 1;  // Mark as active
-    
-    // Get treasure details from user
+    char record[sizeof(Treasure)];
+    size_t record_len;
+    off_t offset;
+    int fd, format;
+    ColumnAppend columns;
+    HuntMeta meta;
+    int has_columns;
+    
+    // Get treasure details from user before taking the hunt's lock
     printf("Enter username (max %d chars): ", MAX_USERNAME - 1);
     fgets(new_treasure.username, MAX_USERNAME, stdin);
     new_treasure.username[strcspn(new_treasure.username, "\n")] = 0;  // Remove newline
@@ -284,266 +206,488 @@ void add_treasure(const char *hunt_id) {
     printf("Enter value: ");
     scanf("%d", &new_treasure.value);
     
-    // Open the file in append mode, create if it doesn't exist
-    fd = open(file_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    // Ensure the hunt directory exists
+    ensure_hunt_directory(hunt_id);
+    
+    // Other writers wait from here until the treasure is fully recorded,
+    // so IDs are handed out one at a time
+    if (lock_hunt(hunt_id, HUNT_LOCK_WRITE) == -1) {
+        exit(1);
+    }
+    
+    // Open the file in append mode, create it (in the current format) if
+    // it doesn't exist
+    fd = open_treasure_append(hunt_id, &format);
     if (fd == -1) {
-        perror("Failed to open treasure file");
         exit(1);
     }
     
-    // Write the new treasure
-    if (write(fd, &new_treasure, sizeof(Treasure)) != sizeof(Treasure)) {
+    // Get the next available ID
+    new_treasure.id = get_next_treasure_id(hunt_id);
+    new_treasure.is_active = 1;  // Mark as active
+    
+    // Write the new treasure in the file's format
+    record_len = encode_treasures(hunt_id, format, &new_treasure, 1, record, 0, NULL);
+    if (record_len == 0 ||
+        journal_begin(hunt_id, JOURNAL_OP_APPEND, new_treasure.id, format, lseek(fd, 0, SEEK_END)) == -1 ||
+        write(fd, record, record_len) != (ssize_t)record_len) {
         perror("Failed to write treasure");
         close(fd);
         exit(1);
     }
     
+    // Index the record at the position it was appended to
+    off_t data_size = lseek(fd, 0, SEEK_CUR);
+    offset = data_size - record_len;
+    index_add_entries(hunt_id, new_treasure.id, 1, &offset, offset, data_size);
+    
+    // Keep a columnar layout in step with the treasure file
+    has_columns = read_hunt_meta(hunt_id, &meta) == 0 &&
+                  columns_begin_append(hunt_id, meta.generation, &columns) == 0;
+    if (has_columns && columns_append(&columns, &new_treasure, 1) == -1) {
+        columns_abort_append(&columns);
+        remove_columns(hunt_id);
+        has_columns = 0;
+    }
+    
+    // The new treasure's contribution to scores.dat
+    ScoreTable scores;
+    if (score_table_init(&scores) == -1 ||
+        score_table_add(&scores, new_treasure.username, new_treasure.value, 1) == -1) {
+        perror("Failed to allocate score table");
+        close(fd);
+        exit(1);
+    }
+    meta_records_added(hunt_id, new_treasure.id, 1, new_treasure.value,
+                       offset, data_size, &scores);
+    score_table_free(&scores);
+    if (has_columns) {
+        columns_finish_append(&columns, hunt_id);
+    }
+    
+    journal_commit(hunt_id, fd);
     close(fd);
     
     // Log the operation
-    strcpy(log_message, "Added treasure ID ");
-    char id_str[16];
-    sprintf(id_str, "%d", new_treasure.id);
-    strcat(log_message, id_str);
-    strcat(log_message, " by ");
-    strcat(log_message, new_treasure.username);
-    
-    log_operation(hunt_id, log_message);
+    log_event(hunt_id, LOG_OP_ADD, new_treasure.id, new_treasure.username, 0, NULL);
+    unlock_hunt(hunt_id);
     
     printf("Treasure added successfully with ID %d\n", new_treasure.id);
 }
 
-// List all treasures in a hunt
-void list_treasures(const char *hunt_id) {
-    char *file_path = get_treasure_file_path(hunt_id);
-    int fd;
-    Treasure treasure;
-    struct stat file_stat;
-    char time_str[30];
-    char log_message[256];
-    int count = 0;
+// Copy a CSV field starting at *pos into dest (at most size - 1 bytes).
+// Quoted fields may contain commas and "" for a quote. Leaves *pos after
+// the separator. Returns 0 if the line ended before the field.
+int next_csv_field(const char **pos, char *dest, size_t size) {
+    const char *p = *pos;
+    size_t len = 0;
+    
+    if (p == NULL) {
+        return 0;
+    }
     
-    // Open the treasure file
-    fd = open(file_path, O_RDONLY);
-    if (fd == -1) {
-        if (errno == ENOENT) {
-            printf("Hunt '%s' has no treasures or does not exist.\n", hunt_id);
-            return;
+    if (*p == '"') {
+        for (p++; *p; p++) {
+            if (*p == '"') {
+                if (p[1] != '"') {
+                    p++;
+                    break;
+                }
+                p++;
+            }
+            if (len + 1 < size) {
+                dest[len++] = *p;
+            }
+        }
+        // Skip anything between the closing quote and the separator
+        while (*p && *p != ',') {
+            p++;
+        }
+    } else {
+        for (; *p && *p != ','; p++) {
+            if (len + 1 < size) {
+                dest[len++] = *p;
+            }
         }
-        perror("Failed to open treasure file");
-        exit(1);
     }
     
-    // Get file stats
-    if (fstat(fd, &file_stat) == -1) {
-        perror("Failed to get file stats");
-        close(fd);
-        exit(1);
+    // Trim the line ending from the last field
+    while (len > 0 && (dest[len - 1] == '\n' || dest[len - 1] == '\r')) {
+        len--;
     }
+    dest[len] = '\0';
     
-    // Format the last modification time
-    format_time(file_stat.st_mtime, time_str);
-    
-    // Print hunt information
-    printf("Hunt: %s\n", hunt_id);
-    printf("Total file size: %ld bytes\n", (long)file_stat.st_size);
-    printf("Last modified: %s\n\n", time_str);
-    printf("Treasures:\n");
-    printf("--------------------------------------------------\n");
+    *pos = (*p == ',') ? p + 1 : NULL;
+    return 1;
+}
+
+// Parse "username,latitude,longitude,clue,value". Returns 0 on success.
+int parse_csv_treasure(const char *line, Treasure *treasure) {
+    char number[64];
+    char *end;
+    
+    if (!next_csv_field(&line, treasure->username, MAX_USERNAME) ||
+        !next_csv_field(&line, number, sizeof(number))) {
+        return -1;
+    }
+    treasure->latitude = strtof(number, &end);
+    if (end == number) {
+        return -1;
+    }
     
-    // Read and print all active treasures
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (treasure.is_active) {
-            printf("ID: %d | User: %s | Value: %d\n", 
-                   treasure.id, treasure.username, treasure.value);
-            count++;
-        }
+    if (!next_csv_field(&line, number, sizeof(number))) {
+        return -1;
+    }
+    treasure->longitude = strtof(number, &end);
+    if (end == number) {
+        return -1;
     }
     
-    if (count == 0) {
-        printf("No active treasures found in this hunt.\n");
+    if (!next_csv_field(&line, treasure->clue, MAX_CLUE) ||
+        !next_csv_field(&line, number, sizeof(number))) {
+        return -1;
+    }
+    treasure->value = (int)strtol(number, &end, 10);
+    if (end == number) {
+        return -1;
     }
     
-    printf("--------------------------------------------------\n");
-    printf("Total treasures: %d\n", count);
+    return treasure->username[0] ? 0 : -1;
+}
+
+// Parse a JSON string at p (just after the opening quote) into dest.
+// Returns a pointer after the closing quote, or NULL if it is malformed.
+const char* parse_json_string(const char *p, char *dest, size_t size) {
+    size_t len = 0;
     
-    close(fd);
+    while (*p && *p != '"') {
+        char c = *p++;
+        
+        if (c == '\\') {
+            switch (*p++) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u':
+                    // Only ASCII code points are kept as is
+                    if (!isxdigit((unsigned char)p[0]) || !isxdigit((unsigned char)p[1]) ||
+                        !isxdigit((unsigned char)p[2]) || !isxdigit((unsigned char)p[3])) {
+                        return NULL;
+                    }
+                    {
+                        char hex[5] = { p[0], p[1], p[2], p[3], '\0' };
+                        long code = strtol(hex, NULL, 16);
+                        c = code < 0x80 ? (char)code : '?';
+                    }
+                    p += 4;
+                    break;
+                case '\0': return NULL;
+                default: c = p[-1]; break;  // \" \\ \/
+            }
+        }
+        
+        if (dest && len + 1 < size) {
+            dest[len++] = c;
+        }
+    }
     
-    // Log the operation
-    strcpy(log_message, "Listed treasures for hunt '");
-    strcat(log_message, hunt_id);
-    strcat(log_message, "'");
-    log_operation(hunt_id, log_message);
+    if (*p != '"') {
+        return NULL;
+    }
+    if (dest) {
+        dest[len] = '\0';
+    }
+    return p + 1;
 }
 
-// View details of a specific treasure
-void view_treasure(const char *hunt_id, int treasure_id) {
-    char *file_path = get_treasure_file_path(hunt_id);
-    int fd;
-    Treasure treasure;
-    int found = 0;
-    char log_message[256];
-    char id_str[16];
-    
-    // Open the treasure file
-    fd = open(file_path, O_RDONLY);
-    if (fd == -1) {
-        if (errno == ENOENT) {
-            printf("Hunt '%s' has no treasures or does not exist.\n", hunt_id);
-            return;
-        }
-        perror("Failed to open treasure file");
-        exit(1);
+// Parse a flat JSON object with the keys username, latitude, longitude,
+// clue and value (other keys are ignored). Returns 0 on success.
+int parse_json_treasure(const char *line, Treasure *treasure) {
+    const char *p = line;
+    char key[32];
+    int seen = 0;
+    
+    while (isspace((unsigned char)*p)) p++;
+    if (*p++ != '{') {
+        return -1;
     }
     
-    // Search for the treasure with the specified ID
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (treasure.is_active && treasure.id == treasure_id) {
-            found = 1;
+    for (;;) {
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '}') {
             break;
         }
-    }
-    
-    close(fd);
-    
-    if (found) {
-        printf("Treasure Details:\n");
-        printf("--------------------------------------------------\n");
-        printf("ID: %d\n", treasure.id);
-        printf("User: %s\n", treasure.username);
-        printf("Location: %.6f, %.6f\n", treasure.latitude, treasure.longitude);
-        printf("Clue: %s\n", treasure.clue);
-        printf("Value: %d\n", treasure.value);
-        printf("--------------------------------------------------\n");
+        if (*p++ != '"' || (p = parse_json_string(p, key, sizeof(key))) == NULL) {
+            return -1;
+        }
+        while (isspace((unsigned char)*p)) p++;
+        if (*p++ != ':') {
+            return -1;
+        }
+        while (isspace((unsigned char)*p)) p++;
         
-        // Log the operation
-        strcpy(log_message, "Viewed treasure ID ");
-        sprintf(id_str, "%d", treasure_id);
-        strcat(log_message, id_str);
-        strcat(log_message, " from hunt '");
-        strcat(log_message, hunt_id);
-        strcat(log_message, "'");
+        if (*p == '"') {
+            char *dest = NULL;
+            size_t size = 0;
+            
+            if (strcmp(key, "username") == 0) {
+                dest = treasure->username;
+                size = MAX_USERNAME;
+                seen |= 1;
+            } else if (strcmp(key, "clue") == 0) {
+                dest = treasure->clue;
+                size = MAX_CLUE;
+            }
+            if ((p = parse_json_string(p + 1, dest, size)) == NULL) {
+                return -1;
+            }
+        } else {
+            char *end;
+            double number = strtod(p, &end);
+            
+            if (end == p) {
+                // true, false or null
+                while (isalpha((unsigned char)*end)) end++;
+                if (end == p) {
+                    return -1;
+                }
+            } else if (strcmp(key, "latitude") == 0) {
+                treasure->latitude = (float)number;
+                seen |= 2;
+            } else if (strcmp(key, "longitude") == 0) {
+                treasure->longitude = (float)number;
+                seen |= 4;
+            } else if (strcmp(key, "value") == 0) {
+                treasure->value = (int)number;
+                seen |= 8;
+            }
+            p = end;
+        }
         
-        log_operation(hunt_id, log_message);
-    } else {
-        printf("Treasure with ID %d not found in hunt '%s'.\n", treasure_id, hunt_id);
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '}') {
+            return -1;
+        }
     }
+    
+    return (seen == 15 && treasure->username[0]) ? 0 : -1;
 }
 
-// Remove a treasure from a hunt
-void remove_treasure(const char *hunt_id, int treasure_id) {
-    char *file_path = get_treasure_file_path(hunt_id);
-    int fd;
-    Treasure treasure;
-    off_t position;
-    int found = 0;
-    char log_message[256];
-    char id_str[16];
-    
-    // Open the treasure file for reading and writing
-    fd = open(file_path, O_RDWR);
-    if (fd == -1) {
-        if (errno == ENOENT) {
-            printf("Hunt '%s' has no treasures or does not exist.\n", hunt_id);
-            return;
+// Append a batch of records in the file's format and index them.
+// data_size is the size of the treasure file, advanced past the batch.
+// Returns 0 on success, -1 on a failed write.
+int write_import_batch(const char *hunt_id, int fd, int format, const Treasure *batch, size_t count,
+                       off_t *data_size) {
+    static char encoded[IMPORT_BATCH_RECORDS * sizeof(Treasure)];
+    static off_t offsets[IMPORT_BATCH_RECORDS];
+    size_t len;
+    
+    len = encode_treasures(hunt_id, format, batch, count, encoded, *data_size, offsets);
+    if (len == 0 || write(fd, encoded, len) != (ssize_t)len) {
+        return -1;
+    }
+    
+    index_add_entries(hunt_id, batch[0].id, count, offsets, *data_size, *data_size + len);
+    *data_size += len;
+    return 0;
+}
+
+// Import treasures from a CSV (username,latitude,longitude,clue,value) or
+// NDJSON stream in one pass. IDs are assigned from the meta block, records
+// are appended in large batches and a single line is logged at the end.
+void import_treasures(const char *hunt_id, const char *source) {
+    static Treasure batch[IMPORT_BATCH_RECORDS];
+    size_t batch_count = 0;
+    FILE *input;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t line_len;
+    long line_number = 0;
+    long skipped = 0;
+    int json = -1;
+    struct stat file_stat;
+    HuntMeta meta;
+    int fd, format;
+    int first_id, next_id;
+    int64_t imported = 0;
+    int64_t value_total = 0;
+    ScoreTable scores;             // Per-user totals of the imported records
+    ColumnAppend columns;
+    int has_columns;
+    off_t start_size, data_size;
+    
+    if (strcmp(source, "-") == 0) {
+        input = stdin;
+    } else {
+        input = fopen(source, "r");
+        if (!input) {
+            perror("Failed to open import file");
+            exit(1);
         }
-        perror("Failed to open treasure file");
+    }
+    
+    ensure_hunt_directory(hunt_id);
+    
+    // The hunt stays locked for the whole import, so its IDs are contiguous
+    if (lock_hunt(hunt_id, HUNT_LOCK_WRITE) == -1) {
         exit(1);
     }
     
-    // Search for the treasure with the specified ID
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        position = lseek(fd, 0, SEEK_CUR) - sizeof(Treasure);
+    fd = open_treasure_append(hunt_id, &format);
+    if (fd == -1) {
+        exit(1);
+    }
+    
+    if (fstat(fd, &file_stat) == -1 || load_hunt_meta(hunt_id, &meta, file_stat.st_size) == -1) {
+        perror("Failed to read hunt state");
+        close(fd);
+        exit(1);
+    }
+    start_size = data_size = file_stat.st_size;
+    if (journal_begin(hunt_id, JOURNAL_OP_APPEND, meta.next_id, format, start_size) == -1) {
+        close(fd);
+        exit(1);
+    }
+    first_id = next_id = meta.next_id;
+    has_columns = columns_begin_append(hunt_id, meta.generation, &columns) == 0;
+    
+    if (score_table_init(&scores) == -1) {
+        perror("Failed to allocate score table");
+        close(fd);
+        exit(1);
+    }
+    
+    while ((line_len = getline(&line, &line_size, input)) != -1) {
+        Treasure *treasure = &batch[batch_count];
+        const char *start = line;
+        int result;
         
-        if (treasure.is_active && treasure.id == treasure_id) {
-            found = 1;
-            
-            // Mark the treasure as inactive
-            treasure.is_active = 0;
+        line_number++;
+        while (isspace((unsigned char)*start)) start++;
+        if (*start == '\0') {
+            continue;
+        }
+        
+        // The first record decides the format
+        if (json == -1) {
+            json = (*start == '{');
             
-            // Move back to the position of this treasure
-            if (lseek(fd, position, SEEK_SET) == -1) {
-                perror("Failed to seek in file");
-                close(fd);
-                exit(1);
+            // Skip a CSV header row
+            if (!json && strncmp(start, "username,", 9) == 0) {
+                continue;
             }
-            
-            // Write the modified treasure
-            if (write(fd, &treasure, sizeof(Treasure)) != sizeof(Treasure)) {
-                perror("Failed to update treasure");
+        }
+        
+        memset(treasure, 0, sizeof(Treasure));
+        result = json ? parse_json_treasure(start, treasure) : parse_csv_treasure(start, treasure);
+        if (result == -1) {
+            fprintf(stderr, "Skipping malformed record on line %ld\n", line_number);
+            skipped++;
+            continue;
+        }
+        
+        treasure->id = next_id++;
+        treasure->is_active = 1;
+        value_total += treasure->value;
+        if (score_table_add(&scores, treasure->username, treasure->value, 1) == -1) {
+            perror("Failed to allocate score table");
+            close(fd);
+            exit(1);
+        }
+        batch_count++;
+        
+        if (batch_count == IMPORT_BATCH_RECORDS) {
+            if (write_import_batch(hunt_id, fd, format, batch, batch_count, &data_size) == -1) {
+                perror("Failed to write treasures");
                 close(fd);
                 exit(1);
             }
-            
-            break;
+            if (has_columns && columns_append(&columns, batch, batch_count) == -1) {
+                columns_abort_append(&columns);
+                remove_columns(hunt_id);
+                has_columns = 0;
+            }
+            imported += batch_count;
+            batch_count = 0;
         }
     }
     
-    close(fd);
+    free(line);
+    if (input != stdin) {
+        fclose(input);
+    }
     
-    if (found) {
-        printf("Treasure with ID %d removed successfully.\n", treasure_id);
-        
-        // Log the operation
-        strcpy(log_message, "Removed treasure ID ");
-        sprintf(id_str, "%d", treasure_id);
-        strcat(log_message, id_str);
-        strcat(log_message, " from hunt '");
-        strcat(log_message, hunt_id);
-        strcat(log_message, "'");
-        
-        log_operation(hunt_id, log_message);
-    } else {
-        printf("Treasure with ID %d not found in hunt '%s'.\n", treasure_id, hunt_id);
+    if (batch_count > 0) {
+        if (write_import_batch(hunt_id, fd, format, batch, batch_count, &data_size) == -1) {
+            perror("Failed to write treasures");
+            close(fd);
+            exit(1);
+        }
+        if (has_columns && columns_append(&columns, batch, batch_count) == -1) {
+            columns_abort_append(&columns);
+            remove_columns(hunt_id);
+            has_columns = 0;
+        }
+        imported += batch_count;
     }
+    
+    if (imported == 0) {
+        printf("No treasures imported into hunt '%s' (%ld malformed records skipped).\n",
+               hunt_id, skipped);
+        score_table_free(&scores);
+        if (has_columns) {
+            columns_abort_append(&columns);
+        }
+        journal_commit(hunt_id, fd);
+        close(fd);
+        unlock_hunt(hunt_id);
+        return;
+    }
+    
+    // Update the meta block once for the whole import
+    meta_records_added(hunt_id, next_id - 1, imported, value_total, start_size, data_size, &scores);
+    score_table_free(&scores);
+    if (has_columns) {
+        columns_finish_append(&columns, hunt_id);
+    }
+    journal_commit(hunt_id, fd);
+    close(fd);
+    
+    log_event(hunt_id, LOG_OP_IMPORT, first_id, NULL, imported, NULL);
+    unlock_hunt(hunt_id);
+    
+    printf("Imported %lld treasures into hunt '%s' with IDs %d-%d (%ld malformed records skipped).\n",
+           (long long)imported, hunt_id, first_id, next_id - 1, skipped);
 }
 
-// Remove a hunt
-void remove_hunt(const char *hunt_id) {
-    char hunt_path[MAX_PATH];
-    char treasure_file[MAX_PATH];
-    char log_file[MAX_PATH];
-    char symlink_path[MAX_PATH] = "./logged_hunt-";
-    char log_message[256];
-    
-    // Construct paths
-    strcpy(hunt_path, HUNT_DIR_PREFIX);
-    strcat(hunt_path, hunt_id);
-    
-    strcpy(treasure_file, hunt_path);
-    strcat(treasure_file, "/treasures.dat");
-    
-    strcpy(log_file, hunt_path);
-    strcat(log_file, "/logged_hunt");
-    
-    strcat(symlink_path, hunt_id);
-    
-    // Log the operation before removing the hunt
-    strcpy(log_message, "Removing hunt '");
-    strcat(log_message, hunt_id);
-    strcat(log_message, "'");
-    log_operation(hunt_id, log_message);
-    
-    // Remove the treasure file
-    delete_file(treasure_file);
-    
-    // Remove the log file
-    delete_file(log_file);
-    
-    // Remove the symlink
-    delete_file(symlink_path);
-    
-    // Remove the hunt directory
-    if (rmdir(hunt_path) == -1) {
-        if (errno == ENOENT) {
-            printf("Hunt '%s' does not exist.\n", hunt_id);
-            return;
-        } else if (errno == ENOTEMPTY) {
-            printf("Hunt directory is not empty. Some files may need to be removed manually.\n");
-        } else {
-            perror("Failed to remove hunt directory");
-        }
-    } else {
-        printf("Hunt '%s' removed successfully.\n", hunt_id);
+// Convert a hunt to the columnar layout (kept up to date from then on), or
+// drop the layout again
+void set_columnar(const char *hunt_id, int enable) {
+    int rows;
+    
+    if (lock_hunt(hunt_id, HUNT_LOCK_WRITE) == -1) {
+        exit(1);
     }
+    
+    if (!enable) {
+        remove_columns(hunt_id);
+        unlock_hunt(hunt_id);
+        printf("Hunt '%s' no longer keeps a columnar layout.\n", hunt_id);
+        return;
+    }
+    
+    rows = convert_to_columns(hunt_id);
+    if (rows == -1) {
+        exit(1);
+    }
+    
+    log_event(hunt_id, LOG_OP_COLUMNAR, 0, NULL, rows, NULL);
+    unlock_hunt(hunt_id);
+    
+    printf("Converted hunt '%s' to the columnar layout: %d rows in %s\n", hunt_id, rows,
+           get_columns_dir_path(hunt_id));
 }
@@ -1,4 +1,7 @@
+#define _DEFAULT_SOURCE  // sigprocmask, usleep
+
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -7,159 +10,313 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
+
+#include "monitor_protocol.h"
+#include "outbuf.h"
+#include "treasure_store.h"
+#include "hunt_log.h"
 
-#define MAX_CMD_LEN 256
-#define COMMAND_FILE "monitor_command.txt"
-#define PARAM_FILE "monitor_params.txt"
 #define DELAY_BEFORE_EXIT 2000000  // 2 seconds in microseconds
+#define MAX_EVENTS 8
+#define REQUEST_BUFFER_SIZE (4 * (sizeof(MonitorRequestHeader) + MONITOR_MAX_PAYLOAD))
 
 // Global variables
-volatile sig_atomic_t should_exit = 0;
-volatile sig_atomic_t received_command = 0;
+bool should_exit = false;
+int request_fd = -1;                // Requests from the hub
+int response_fd = -1;               // Responses to the hub
+char request_buffer[REQUEST_BUFFER_SIZE];
+size_t request_buffer_len = 0;
 
 // Function prototypes
-void handle_sigusr1(int sig);
-void handle_command();
-void execute_treasure_manager(const char *action, const char *params);
-void list_hunts();
-void list_treasures(const char *hunt_id);
-void view_treasure(const char *hunt_id, const char *treasure_id);
+int send_response_frame(uint32_t request_id, uint16_t type, uint16_t status,
+                        const struct iovec *iov, int iov_count);
+int response_sink(void *context, const struct iovec *iov, int iov_count);
+void monitor_message(const char *format, ...);
+void handle_request(const MonitorRequestHeader *header, const char *payload);
+void read_requests();
+int handle_list_hunts();
+int handle_list_treasures(const char *hunt_id);
+int handle_view_treasure(const char *hunt_id, const char *treasure_id);
 
 
-void handle_sigusr1() {
-    received_command = 1;
+/* Write one response frame: the header followed by the given payload */
+int send_response_frame(uint32_t request_id, uint16_t type, uint16_t status,
+                        const struct iovec *iov, int iov_count) {
+    MonitorResponseHeader header;
+    struct iovec frame[4];
+    int count = 1;
+    
+    memset(&header, 0, sizeof(header));
+    header.request_id = request_id;
+    header.type = type;
+    header.status = status;
+    
+    frame[0].iov_base = &header;
+    frame[0].iov_len = sizeof(header);
+    for (int i = 0; i < iov_count && count < 4; i++) {
+        if (iov[i].iov_len > 0) {
+            frame[count++] = iov[i];
+            header.length += iov[i].iov_len;
+        }
+    }
+    
+    return outbuf_writev_all(response_fd, frame, count);
 }
 
 
-void handle_command() {
-    char command[MAX_CMD_LEN] = {0};
-    char params[MAX_CMD_LEN] = {0};
-    FILE *cmd_file, *param_file;
+/* Output sink: whatever the store prints while a request is handled is
+   sent back as DATA frames of that request, split at MONITOR_MAX_DATA */
+int response_sink(void *context, const struct iovec *iov, int iov_count) {
+    uint32_t request_id = *(const uint32_t *)context;
     
-    /* Read command */
-    cmd_file = fopen(COMMAND_FILE, "r");
-    if (cmd_file) {
-        if (fgets(command, MAX_CMD_LEN, cmd_file)) {
-            /* Remove newline character if present */
-            size_t len = strlen(command);
-            if (len > 0 && command[len - 1] == '\n') {
-                command[len - 1] = '\0';
+    for (int i = 0; i < iov_count; i++) {
+        struct iovec piece;
+        size_t done = 0;
+        
+        while (done < iov[i].iov_len) {
+            piece.iov_base = (char *)iov[i].iov_base + done;
+            piece.iov_len = iov[i].iov_len - done;
+            if (piece.iov_len > MONITOR_MAX_DATA) {
+                piece.iov_len = MONITOR_MAX_DATA;
+            }
+            if (send_response_frame(request_id, MONITOR_RESPONSE_DATA, MONITOR_STATUS_OK,
+                                    &piece, 1) == -1) {
+                return -1;
             }
+            done += piece.iov_len;
         }
-        fclose(cmd_file);
-    } else {
-        perror("Failed to open command file");
-        return;
     }
     
-    /* Read parameters if they exist */
-    param_file = fopen(PARAM_FILE, "r");
-    if (param_file) {
-        if (fgets(params, MAX_CMD_LEN, param_file)) {
-            /* Remove newline character if present */
-            size_t len = strlen(params);
-            if (len > 0 && params[len - 1] == '\n') {
-                params[len - 1] = '\0';
+    return 0;
+}
+
+
+/* Print a monitor message as part of the current response */
+void monitor_message(const char *format, ...) {
+    OutBuf out;
+    va_list args;
+    char text[MAX_PATH * 2];
+    
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    
+    outbuf_init(&out, STDOUT_FILENO);
+    outbuf_write(&out, text, strlen(text));
+    outbuf_flush(&out);
+}
+
+
+void handle_request(const MonitorRequestHeader *header, const char *payload) {
+    uint32_t request_id = header->request_id;
+    int result = 0;
+    
+    /* Capture the output of this request */
+    outbuf_set_stdout_sink(response_sink, &request_id);
+    
+    switch (header->command) {
+        case MONITOR_CMD_LIST_HUNTS:
+            result = handle_list_hunts();
+            break;
+        case MONITOR_CMD_LIST_TREASURES:
+            result = handle_list_treasures(payload);
+            break;
+        case MONITOR_CMD_VIEW_TREASURE: {
+            /* Payload: hunt_id '\0' treasure_id */
+            const char *treasure_id = payload + strlen(payload) + 1;
+            if (treasure_id >= payload + header->length) {
+                monitor_message("Monitor: Missing treasure ID\n");
+                result = -1;
+            } else {
+                result = handle_view_treasure(payload, treasure_id);
             }
+            break;
         }
-        fclose(param_file);
+        case MONITOR_CMD_STOP:
+            monitor_message("Monitor received stop command. Preparing to exit...\n");
+            should_exit = true;
+            break;
+        default:
+            monitor_message("Monitor: Unknown command %u\n", header->command);
+            result = -1;
+            break;
     }
     
-    /* Process the command */
-    if (strcmp(command, "list_hunts") == 0) {
-        list_hunts();
-    } else if (strcmp(command, "list_treasures") == 0) {
-        list_treasures(params);
-    } else if (strcmp(command, "view_treasure") == 0) {
-        char hunt_id[MAX_CMD_LEN] = {0};
-        char treasure_id[MAX_CMD_LEN] = {0};
-        
-        /* Parse parameters */
-        sscanf(params, "%s %s", hunt_id, treasure_id);
-        view_treasure(hunt_id, treasure_id);
-    } else if (strcmp(command, "stop") == 0) {
-        printf("Monitor received stop command. Preparing to exit...\n");
-        should_exit = 1;
-    } else {
-        printf("Monitor: Unknown command '%s'\n", command);
-    }
+    outbuf_set_stdout_sink(NULL, NULL);
+    
+    send_response_frame(request_id, MONITOR_RESPONSE_END,
+                        result == 0 ? MONITOR_STATUS_OK : MONITOR_STATUS_ERROR, NULL, 0);
 }
 
-void execute_treasure_manager(const char *action, const char *params) {
-    pid_t pid;
-    int status;
+
+/* Read whatever is available on the request pipe and handle every
+   complete request in it */
+void read_requests() {
+    ssize_t bytes_read;
+    size_t offset = 0;
     
-    pid = fork();
-    if (pid < 0) {
-        perror("Fork failed");
+    bytes_read = read(request_fd, request_buffer + request_buffer_len,
+                      sizeof(request_buffer) - request_buffer_len);
+    if (bytes_read == 0) {
+        /* The hub closed its end: nobody is left to answer */
+        should_exit = true;
+        return;
+    }
+    if (bytes_read == -1) {
+        if (errno != EAGAIN && errno != EINTR) {
+            perror("Failed to read request");
+            should_exit = true;
+        }
         return;
-    } else if (pid == 0) {
-        /* Child process */
-        if (params) {
-            execlp("./treasure_manager", "treasure_manager", action, params, NULL);
-        } else {
-            execlp("./treasure_manager", "treasure_manager", action, NULL);
+    }
+    request_buffer_len += bytes_read;
+    
+    while (request_buffer_len - offset >= sizeof(MonitorRequestHeader)) {
+        MonitorRequestHeader header;
+        char payload[MONITOR_MAX_PAYLOAD + 1];
+        
+        memcpy(&header, request_buffer + offset, sizeof(header));
+        if (header.length > MONITOR_MAX_PAYLOAD) {
+            fprintf(stderr, "Monitor: Request %u is too large, closing connection\n",
+                    header.request_id);
+            should_exit = true;
+            return;
         }
-        perror("Exec failed");
-        exit(EXIT_FAILURE);
-    } else {
-        /* Parent process - wait for the child to complete */
-        waitpid(pid, &status, 0);
-        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-            printf("Treasure manager exited with status %d\n", WEXITSTATUS(status));
+        if (request_buffer_len - offset < sizeof(header) + header.length) {
+            break;
+        }
+        
+        /* NUL-terminate the payload so its strings can be used directly */
+        memcpy(payload, request_buffer + offset + sizeof(header), header.length);
+        payload[header.length] = '\0';
+        offset += sizeof(header) + header.length;
+        
+        handle_request(&header, payload);
+        if (should_exit) {
+            break;
         }
     }
+    
+    /* Keep a partial request for the next read */
+    memmove(request_buffer, request_buffer + offset, request_buffer_len - offset);
+    request_buffer_len -= offset;
 }
 
 
-void list_hunts() {
-    printf("Monitor: Listing all hunts\n");
-    execute_treasure_manager("list", NULL);
+/* Queries run in-process through the treasure store instead of
+   forking ./treasure_manager for every request */
+int handle_list_hunts() {
+    monitor_message("Monitor: Listing all hunts\n");
+    return list_hunts();
 }
 
 
-void list_treasures(const char *hunt_id) {
-    printf("Monitor: Listing treasures for hunt %s\n", hunt_id);
-    execute_treasure_manager("show", hunt_id);
+int handle_list_treasures(const char *hunt_id) {
+    monitor_message("Monitor: Listing treasures for hunt %s\n", hunt_id);
+    return list_treasures(hunt_id);
 }
 
 
-void view_treasure(const char *hunt_id, const char *treasure_id) {
-    char params[MAX_CMD_LEN];
-    
-    printf("Monitor: Viewing treasure %s in hunt %s\n", treasure_id, hunt_id);
-    snprintf(params, sizeof(params), "%s %s", hunt_id, treasure_id);
-    execute_treasure_manager("view", params);
+int handle_view_treasure(const char *hunt_id, const char *treasure_id) {
+    monitor_message("Monitor: Viewing treasure %s in hunt %s\n", treasure_id, hunt_id);
+    return view_treasure(hunt_id, atoi(treasure_id));
 }
 
 
-int main() {
-    struct sigaction sa;
+int main(int argc, char *argv[]) {
+    sigset_t mask;
+    struct epoll_event event;
+    struct epoll_event events[MAX_EVENTS];
+    struct signalfd_siginfo info;
+    int signal_fd, epoll_fd;
+    
+    if (argc < 3) {
+        fprintf(stderr, "Format: treasure_monitor <request_fd> <response_fd>\n");
+        return 1;
+    }
+    request_fd = atoi(argv[1]);
+    response_fd = atoi(argv[2]);
+    fcntl(request_fd, F_SETFL, fcntl(request_fd, F_GETFL, 0) | O_NONBLOCK);
+    
+    /* Deliver SIGTERM through a signalfd, so the loop can sleep in
+       epoll_wait until either a request or a stop signal arrives */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        perror("Failed to block SIGTERM");
+        return 1;
+    }
+    
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror("Failed to create signalfd");
+        return 1;
+    }
     
-    /* Set up signal handler for SIGUSR1 */
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = handle_sigusr1;
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGUSR1, &sa, NULL);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("Failed to create epoll instance");
+        return 1;
+    }
+    
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = signal_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) == -1) {
+        perror("Failed to watch signalfd");
+        return 1;
+    }
+    
+    event.data.fd = request_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, request_fd, &event) == -1) {
+        perror("Failed to watch request pipe");
+        return 1;
+    }
     
     printf("Treasure Monitor started (PID: %d)\n", getpid());
+    fflush(stdout);
     
-    /* Main loop */
+    /* Main loop: block until an event is ready, or until buffered log
+       entries are due to be written */
     while (!should_exit) {
-        if (received_command) {
-            handle_command();
-            received_command = 0;
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, log_next_flush_ms());
+        
+        log_flush_due();
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            break;
         }
         
-        /* Sleep briefly to avoid busy waiting */
-        usleep(100000);  /* Sleep for 0.1 seconds */
+        for (int i = 0; i < ready && !should_exit; i++) {
+            if (events[i].data.fd == request_fd) {
+                read_requests();
+            } else if (events[i].data.fd == signal_fd) {
+                while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                }
+                printf("Monitor received SIGTERM. Preparing to exit...\n");
+                should_exit = true;
+            }
+        }
     }
     
+    close(epoll_fd);
+    close(signal_fd);
+    close(request_fd);
+    close(response_fd);
+    
     /* Delay before actually exiting */
     printf("Monitor: Delaying before exit...\n");
+    fflush(stdout);
     usleep(DELAY_BEFORE_EXIT);
     printf("Monitor: Exiting now\n");
     
+    log_flush_all();
+    close_treasure_files();
     return 0;
 }
@@ -0,0 +1,2009 @@
+#define _DEFAULT_SOURCE  // pread/pwrite, madvise
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include "outbuf.h"
+#include "treasure_store.h"
+#include "treasure_columns.h"
+#include "spatial_index.h"
+#include "hunt_log.h"
+#include "hunt_journal.h"
+#include "user_dict.h"
+
+#define OPEN_FILE_CACHE_SIZE 16     // Treasure files kept open between queries
+
+// Read-only treasure file kept open between queries, so a long-running
+// caller such as the monitor does not reopen the hunt for every request
+typedef struct {
+    char hunt_id[MAX_PATH];
+    int fd;
+    dev_t dev;
+    ino_t ino;
+} OpenTreasureFile;
+
+static OpenTreasureFile open_files[OPEN_FILE_CACHE_SIZE];
+static int open_files_next = 0;     // Slot replaced by the next miss
+
+void format_time(time_t time_value, char *buffer) {
+    struct tm local_time;
+    struct tm *time_info;
+    
+    // localtime_r: plain localtime() re-reads the time zone on every call
+    time_info = localtime_r(&time_value, &local_time);
+    
+    // Format: YYYY-MM-DD HH:MM:SS
+    sprintf(buffer, "%04d-%02d-%02d %02d:%02d:%02d",
+            time_info->tm_year + 1900,
+            time_info->tm_mon + 1,
+            time_info->tm_mday,
+            time_info->tm_hour,
+            time_info->tm_min,
+            time_info->tm_sec);
+}
+
+void delete_file(const char *filepath) {
+    if (remove(filepath) == -1 && errno != ENOENT) {
+        perror("Failed to remove file");
+    }
+}
+
+void create_link(const char *target, const char *linkpath) {
+    // Try to remove existing link if it exists
+    remove(linkpath);
+    
+    if (symlink(target, linkpath) == -1) {
+        perror("Failed to create symbolic link");
+    }
+}
+
+void ensure_hunt_directory(const char *hunt_id) {
+    char hunt_path[MAX_PATH];
+    
+    // Create hunts directory if it doesn't exist
+    mkdir("hunts", 0755);
+    
+    // Construct the hunt directory path
+    strcpy(hunt_path, HUNT_DIR_PREFIX);
+    strcat(hunt_path, hunt_id);
+    
+    // Create hunt directory if it doesn't exist, and link its log from
+    // the working directory once when the hunt is created
+    if (mkdir(hunt_path, 0755) == -1) {
+        if (errno != EEXIST) {
+            perror("Failed to create hunt directory");
+            exit(1);
+        }
+    } else {
+        create_symlink(hunt_id);
+    }
+}
+
+// Get the path to the treasure file for a hunt
+char* get_treasure_file_path(const char *hunt_id) {
+    static char file_path[MAX_PATH];
+    
+    strcpy(file_path, HUNT_DIR_PREFIX);
+    strcat(file_path, hunt_id);
+    strcat(file_path, "/treasures.dat");
+    
+    return file_path;
+}
+
+// Get the path to the log file for a hunt
+char* get_log_file_path(const char *hunt_id) {
+    static char log_path[MAX_PATH];
+    
+    strcpy(log_path, HUNT_DIR_PREFIX);
+    strcat(log_path, hunt_id);
+    strcat(log_path, "/logged_hunt");
+    
+    return log_path;
+}
+
+// Tell the format of an open treasure file from its first bytes
+int treasure_file_format(int fd) {
+    TreasureFileHeader header;
+    
+    if (pread(fd, &header, sizeof(header), 0) == sizeof(header) && header.magic == TREASURE_FILE_MAGIC &&
+        (header.version == TREASURE_FORMAT_V2 || header.version == TREASURE_FORMAT_V3)) {
+        return (int)header.version;
+    }
+    
+    return TREASURE_FORMAT_V1;
+}
+
+// File offset of the first record in a treasure file of the given format
+off_t treasure_data_start(int format) {
+    return format == TREASURE_FORMAT_V1 ? 0 : (off_t)sizeof(TreasureFileHeader);
+}
+
+// Encode records of a hunt in the given format into buffer, which must
+// hold count * sizeof(Treasure) bytes. Version 3 records get their user IDs
+// from the hunt's dictionary, which learns new names on the way. When
+// offsets is not NULL it receives the file offset of each record if buffer
+// is written at offset base. Returns the number of bytes encoded, or 0 on
+// error.
+size_t encode_treasures(const char *hunt_id, int format, const Treasure *records, size_t count,
+                        char *buffer, off_t base, off_t *offsets) {
+    UserDict *dict = NULL;
+    size_t len = 0;
+    
+    if (format == TREASURE_FORMAT_V3 && (dict = user_dict_get(hunt_id)) == NULL) {
+        return 0;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        const Treasure *treasure = &records[i];
+        size_t username_len, clue_len, size;
+        
+        if (offsets) {
+            offsets[i] = base + (off_t)len;
+        }
+        
+        if (format == TREASURE_FORMAT_V1) {
+            memcpy(buffer + len, treasure, sizeof(Treasure));
+            len += sizeof(Treasure);
+            continue;
+        }
+        
+        username_len = strnlen(treasure->username, MAX_USERNAME - 1);
+        clue_len = strnlen(treasure->clue, MAX_CLUE - 1);
+        
+        if (format == TREASURE_FORMAT_V3) {
+            TreasureRecordV3 record;
+            
+            size = TREASURE_RECORD_V3_SIZE(clue_len);
+            record.id = treasure->id;
+            record.latitude = treasure->latitude;
+            record.longitude = treasure->longitude;
+            record.value = treasure->value;
+            record.is_active = treasure->is_active;
+            record.reserved = 0;
+            record.clue_len = (uint16_t)clue_len;
+            if (user_dict_intern(dict, treasure->username, &record.user_id) == -1) {
+                return 0;
+            }
+            
+            memcpy(buffer + len, &record, sizeof(record));
+            memcpy(buffer + len + sizeof(record), treasure->clue, clue_len);
+            memset(buffer + len + sizeof(record) + clue_len, 0, size - sizeof(record) - clue_len);
+        } else {
+            TreasureRecordV2 record;
+            
+            size = TREASURE_RECORD_V2_SIZE(username_len, clue_len);
+            record.id = treasure->id;
+            record.latitude = treasure->latitude;
+            record.longitude = treasure->longitude;
+            record.value = treasure->value;
+            record.is_active = treasure->is_active;
+            record.username_len = (uint8_t)username_len;
+            record.clue_len = (uint16_t)clue_len;
+            
+            memcpy(buffer + len, &record, sizeof(record));
+            memcpy(buffer + len + sizeof(record), treasure->username, username_len);
+            memcpy(buffer + len + sizeof(record) + username_len, treasure->clue, clue_len);
+            memset(buffer + len + sizeof(record) + username_len + clue_len, 0,
+                   size - sizeof(record) - username_len - clue_len);
+        }
+        len += size;
+    }
+    
+    return len;
+}
+
+// Look up the name of a user ID, catching up with the dictionary file if
+// the ID is newer than the cached copy
+static void resolve_username(UserDict **dict, const char *hunt_id, uint32_t user_id, char *username) {
+    const char *name = *dict ? user_dict_name(*dict, user_id) : NULL;
+    
+    if (!name && hunt_id && (*dict = user_dict_get(hunt_id)) != NULL) {
+        name = user_dict_name(*dict, user_id);
+    }
+    
+    if (name) {
+        strcpy(username, name);
+    } else {
+        snprintf(username, MAX_USERNAME, "#%u", user_id);
+    }
+}
+
+// Decode the version 2 or 3 record at the start of data. For version 3 the
+// user ID goes to user_id and the name is resolved through dict (or left
+// empty if dict is NULL). Returns
+// the record size, or 0 if the bytes do not hold a complete, well-formed
+// record.
+static size_t decode_treasure(int format, UserDict **dict, const char *hunt_id, const char *data,
+                              size_t len, Treasure *treasure, uint32_t *user_id) {
+    size_t size;
+    
+    if (format == TREASURE_FORMAT_V3) {
+        TreasureRecordV3 record;
+        
+        if (len < sizeof(record)) {
+            return 0;
+        }
+        
+        memcpy(&record, data, sizeof(record));
+        size = TREASURE_RECORD_V3_SIZE(record.clue_len);
+        if (record.clue_len >= MAX_CLUE || size > len) {
+            return 0;
+        }
+        
+        treasure->id = record.id;
+        treasure->latitude = record.latitude;
+        treasure->longitude = record.longitude;
+        treasure->value = record.value;
+        treasure->is_active = record.is_active;
+        memcpy(treasure->clue, data + sizeof(record), record.clue_len);
+        treasure->clue[record.clue_len] = '\0';
+        if (dict) {
+            resolve_username(dict, hunt_id, record.user_id, treasure->username);
+        } else {
+            treasure->username[0] = '\0';
+        }
+        *user_id = record.user_id;
+        
+        return size;
+    }
+    
+    TreasureRecordV2 record;
+    
+    if (len < sizeof(record)) {
+        return 0;
+    }
+    
+    memcpy(&record, data, sizeof(record));
+    size = TREASURE_RECORD_V2_SIZE(record.username_len, record.clue_len);
+    if (record.username_len >= MAX_USERNAME || record.clue_len >= MAX_CLUE || size > len) {
+        return 0;
+    }
+    
+    treasure->id = record.id;
+    treasure->latitude = record.latitude;
+    treasure->longitude = record.longitude;
+    treasure->value = record.value;
+    treasure->is_active = record.is_active;
+    memcpy(treasure->username, data + sizeof(record), record.username_len);
+    treasure->username[record.username_len] = '\0';
+    memcpy(treasure->clue, data + sizeof(record) + record.username_len, record.clue_len);
+    treasure->clue[record.clue_len] = '\0';
+    
+    return size;
+}
+
+// Read the record of a hunt at the given offset. Returns 0 on success, -1
+// if there is no complete record there.
+int read_treasure_at(const char *hunt_id, int fd, int format, off_t offset, Treasure *treasure) {
+    char record[TREASURE_RECORD_MAX];
+    UserDict *dict = NULL;
+    uint32_t user_id;
+    ssize_t bytes_read;
+    
+    if (format == TREASURE_FORMAT_V1) {
+        return pread(fd, treasure, sizeof(Treasure), offset) == sizeof(Treasure) ? 0 : -1;
+    }
+    
+    // The record may be shorter than the maximum read at the end of the file
+    bytes_read = pread(fd, record, sizeof(record), offset);
+    if (bytes_read <= 0 ||
+        decode_treasure(format, &dict, hunt_id, record, bytes_read, treasure, &user_id) == 0) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Set the active flag of the record at the given offset in place
+int set_treasure_active(int fd, int format, off_t offset, int active) {
+    char flag = active ? 1 : 0;
+    
+    if (format == TREASURE_FORMAT_V3) {
+        offset += offsetof(TreasureRecordV3, is_active);
+    } else if (format == TREASURE_FORMAT_V2) {
+        offset += offsetof(TreasureRecordV2, is_active);
+    } else {
+        offset += offsetof(Treasure, is_active);
+    }
+    
+    return pwrite(fd, &flag, 1, offset) == 1 ? 0 : -1;
+}
+
+// Clear the active flag of the record at the given offset in place
+int mark_treasure_removed(int fd, int format, off_t offset) {
+    return set_treasure_active(fd, format, offset, 0);
+}
+
+// Open the hunt's treasure file for appending, creating it in the current
+// format (with its header) if it is missing or empty. Returns the fd and
+// the file's format, or -1 on error.
+int open_treasure_append(const char *hunt_id, int *format) {
+    TreasureFileHeader header;
+    struct stat file_stat;
+    int fd;
+    
+    fd = open(get_treasure_file_path(hunt_id), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd == -1) {
+        perror("Failed to open treasure file");
+        return -1;
+    }
+    
+    if (fstat(fd, &file_stat) == -1) {
+        perror("Failed to get file stats");
+        close(fd);
+        return -1;
+    }
+    
+    if (file_stat.st_size > 0) {
+        *format = treasure_file_format(fd);
+        return fd;
+    }
+    
+    *format = TREASURE_FORMAT_CURRENT;
+    if (*format != TREASURE_FORMAT_V1) {
+        header.magic = TREASURE_FILE_MAGIC;
+        header.version = (uint32_t)*format;
+        if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+            perror("Failed to write treasure file header");
+            close(fd);
+            return -1;
+        }
+    }
+    
+    return fd;
+}
+
+// Start a sequential scan of a hunt's open treasure file. Returns 0 on
+// success.
+int scan_open(TreasureScan *scan, const char *hunt_id, int fd) {
+    struct stat file_stat;
+    
+    memset(scan, 0, sizeof(TreasureScan));
+    scan->fd = fd;
+    scan->hunt_id = hunt_id;
+    scan->user_id = SCAN_NO_USER_ID;
+    scan->resolve_names = 1;
+    
+    if (fstat(fd, &file_stat) == -1) {
+        perror("Failed to get file stats");
+        return -1;
+    }
+    
+    scan->format = treasure_file_format(fd);
+    scan->next_offset = treasure_data_start(scan->format);
+    if (scan->format == TREASURE_FORMAT_V3) {
+        scan->dict = user_dict_get(hunt_id);
+    }
+    
+    // Map the whole file and walk the records in place
+    if (file_stat.st_size > scan->next_offset) {
+        void *map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, file_stat.st_size, MADV_SEQUENTIAL);
+            scan->map = map;
+            scan->map_len = file_stat.st_size;
+            scan->data = map;
+            scan->len = file_stat.st_size;
+            scan->pos = scan->next_offset;
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+    
+    // Fall back to reading the file in large chunks
+    scan->buffer = malloc(SCAN_BUFFER_RECORDS * sizeof(Treasure));
+    if (!scan->buffer) {
+        perror("Failed to allocate scan buffer");
+        return -1;
+    }
+    scan->data = scan->buffer;
+    lseek(fd, scan->next_offset, SEEK_SET);
+    
+    return 0;
+}
+
+// Return the next record (active or not), or NULL at the end of the file
+const Treasure* scan_next(TreasureScan *scan) {
+    const Treasure *treasure;
+    size_t size;
+    
+    for (;;) {
+        if (scan->format == TREASURE_FORMAT_V1) {
+            size = scan->len - scan->pos >= sizeof(Treasure) ? sizeof(Treasure) : 0;
+            treasure = (const Treasure *)(scan->data + scan->pos);
+        } else {
+            size = decode_treasure(scan->format, scan->resolve_names ? &scan->dict : NULL,
+                                   scan->hunt_id, scan->data + scan->pos,
+                                   scan->len - scan->pos, &scan->current, &scan->user_id);
+            treasure = &scan->current;
+        }
+        if (size > 0) {
+            break;
+        }
+        
+        // Out of complete records: refill the buffer, keeping the partial one
+        ssize_t bytes_read;
+        size_t kept = scan->len - scan->pos;
+        
+        if (!scan->buffer) {
+            return NULL;
+        }
+        
+        memmove(scan->buffer, scan->buffer + scan->pos, kept);
+        bytes_read = read(scan->fd, scan->buffer + kept, SCAN_BUFFER_RECORDS * sizeof(Treasure) - kept);
+        if (bytes_read <= 0) {
+            // A trailing partial record is dropped
+            return NULL;
+        }
+        scan->len = kept + bytes_read;
+        scan->pos = 0;
+    }
+    
+    scan->pos += size;
+    scan->offset = scan->next_offset;
+    scan->next_offset += size;
+    return treasure;
+}
+
+// Release the mapping or buffer of a scan (the fd stays open)
+void scan_close(TreasureScan *scan) {
+    if (scan->map) {
+        munmap(scan->map, scan->map_len);
+    }
+    free(scan->buffer);
+    memset(scan, 0, sizeof(TreasureScan));
+}
+
+// Get the path to the ID index file for a hunt
+char* get_index_file_path(const char *hunt_id) {
+    static char index_path[MAX_PATH];
+    
+    strcpy(index_path, HUNT_DIR_PREFIX);
+    strcat(index_path, hunt_id);
+    strcat(index_path, "/treasures.idx");
+    
+    return index_path;
+}
+
+// Rebuild the ID index from the treasure file (written to a temp file and
+// renamed into place). Returns 0 on success, -1 on failure.
+int rebuild_treasure_index(const char *hunt_id) {
+    char index_path[MAX_PATH];
+    char temp_path[MAX_PATH + 24];
+    TreasureScan scan;
+    const Treasure *treasure;
+    IndexHeader header;
+    int64_t *slots = NULL;
+    size_t slot_count = 0;
+    off_t data_size = 0;
+    int fd, index_fd;
+    
+    strcpy(index_path, get_index_file_path(hunt_id));
+    strcpy(temp_path, index_path);
+    sprintf(temp_path + strlen(temp_path), ".%d.tmp", (int)getpid());
+    
+    fd = open(get_treasure_file_path(hunt_id), O_RDONLY);
+    if (fd == -1 && errno != ENOENT) {
+        perror("Failed to open treasure file");
+        return -1;
+    }
+    
+    // Map every active ID to the offset of its record
+    if (fd != -1) {
+        data_size = lseek(fd, 0, SEEK_END);
+        if (scan_open(&scan, hunt_id, fd) == -1) {
+            close(fd);
+            return -1;
+        }
+        
+        while ((treasure = scan_next(&scan)) != NULL) {
+            if (!treasure->is_active || treasure->id <= 0) {
+                continue;
+            }
+            if ((size_t)treasure->id > slot_count) {
+                size_t new_count = slot_count ? slot_count : 1024;
+                while (new_count < (size_t)treasure->id) {
+                    new_count *= 2;
+                }
+                int64_t *grown = realloc(slots, new_count * sizeof(int64_t));
+                if (!grown) {
+                    perror("Failed to allocate index");
+                    free(slots);
+                    scan_close(&scan);
+                    close(fd);
+                    return -1;
+                }
+                memset(grown + slot_count, 0, (new_count - slot_count) * sizeof(int64_t));
+                slots = grown;
+                slot_count = new_count;
+            }
+            slots[treasure->id - 1] = scan.offset + 1;
+        }
+        
+        scan_close(&scan);
+        close(fd);
+    }
+    
+    // Trim unused slots at the end
+    while (slot_count > 0 && slots[slot_count - 1] == 0) {
+        slot_count--;
+    }
+    
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.data_size = data_size;
+    
+    index_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (index_fd == -1) {
+        perror("Failed to create index file");
+        free(slots);
+        return -1;
+    }
+    
+    if (write(index_fd, &header, sizeof(header)) != sizeof(header) ||
+        (slot_count > 0 &&
+         write(index_fd, slots, slot_count * sizeof(int64_t)) != (ssize_t)(slot_count * sizeof(int64_t)))) {
+        perror("Failed to write index file");
+        close(index_fd);
+        free(slots);
+        unlink(temp_path);
+        return -1;
+    }
+    
+    close(index_fd);
+    free(slots);
+    
+    if (rename(temp_path, index_path) == -1) {
+        perror("Failed to install index file");
+        unlink(temp_path);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Open the index and check that it describes a treasure file of the given
+// size, rebuilding it otherwise. Returns the open fd or -1.
+int open_index(const char *hunt_id, off_t data_size, int flags) {
+    IndexHeader header;
+    int attempt;
+    
+    for (attempt = 0; attempt < 2; attempt++) {
+        int index_fd = open(get_index_file_path(hunt_id), flags);
+        
+        if (index_fd != -1) {
+            if (pread(index_fd, &header, sizeof(header), 0) == sizeof(header) &&
+                header.magic == INDEX_MAGIC &&
+                header.version == INDEX_VERSION &&
+                header.data_size == data_size) {
+                return index_fd;
+            }
+            close(index_fd);
+        } else if (errno != ENOENT) {
+            perror("Failed to open index file");
+            return -1;
+        }
+        
+        if (attempt == 0 && rebuild_treasure_index(hunt_id) == -1) {
+            return -1;
+        }
+    }
+    
+    return -1;
+}
+
+// Record treasures with consecutive IDs starting at first_id that were
+// appended at the given offsets. start_size and data_size are the sizes of
+// the treasure file before and after the append.
+void index_add_entries(const char *hunt_id, int first_id, size_t count, const off_t *offsets,
+                       off_t start_size, off_t data_size) {
+    IndexHeader header;
+    int64_t slots[SCAN_BUFFER_RECORDS];
+    size_t done = 0;
+    
+    // The index must describe the file as it was before the append
+    int index_fd = open_index(hunt_id, start_size, O_RDWR);
+    if (index_fd == -1) {
+        return;
+    }
+    
+    while (done < count) {
+        size_t chunk = count - done < SCAN_BUFFER_RECORDS ? count - done : SCAN_BUFFER_RECORDS;
+        
+        for (size_t i = 0; i < chunk; i++) {
+            slots[i] = offsets[done + i] + 1;
+        }
+        
+        if (pwrite(index_fd, slots, chunk * sizeof(int64_t),
+                   sizeof(IndexHeader) + (off_t)(first_id - 1 + done) * sizeof(int64_t)) !=
+            (ssize_t)(chunk * sizeof(int64_t))) {
+            perror("Failed to update index file");
+            close(index_fd);
+            unlink(get_index_file_path(hunt_id));
+            return;
+        }
+        done += chunk;
+    }
+    
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.data_size = data_size;
+    
+    if (pwrite(index_fd, &header, sizeof(header), 0) != sizeof(header)) {
+        perror("Failed to update index file");
+        close(index_fd);
+        unlink(get_index_file_path(hunt_id));
+        return;
+    }
+    
+    close(index_fd);
+}
+
+// Clear the index entry of a removed treasure
+void index_remove_entry(const char *hunt_id, int treasure_id, off_t data_size) {
+    int64_t slot = 0;
+    struct stat index_stat;
+    off_t slot_pos = sizeof(IndexHeader) + (off_t)(treasure_id - 1) * sizeof(int64_t);
+    
+    int index_fd = open_index(hunt_id, data_size, O_RDWR);
+    if (index_fd == -1) {
+        return;
+    }
+    
+    // Slots past the end of the index are already empty
+    if (fstat(index_fd, &index_stat) == 0 && slot_pos < index_stat.st_size) {
+        if (pwrite(index_fd, &slot, sizeof(slot), slot_pos) != sizeof(slot)) {
+            perror("Failed to update index file");
+            close(index_fd);
+            unlink(get_index_file_path(hunt_id));
+            return;
+        }
+    }
+    
+    close(index_fd);
+}
+
+// Look up the offset of the active record with the given ID.
+// Returns -1 if the ID has no active record.
+off_t index_lookup(const char *hunt_id, int treasure_id, off_t data_size) {
+    int64_t slot = 0;
+    
+    if (treasure_id <= 0) {
+        return -1;
+    }
+    
+    int index_fd = open_index(hunt_id, data_size, O_RDONLY);
+    if (index_fd == -1) {
+        return -1;
+    }
+    
+    // A short read means the ID is beyond the last indexed slot
+    if (pread(index_fd, &slot, sizeof(slot),
+              sizeof(IndexHeader) + (off_t)(treasure_id - 1) * sizeof(int64_t)) != sizeof(slot)) {
+        slot = 0;
+    }
+    
+    close(index_fd);
+    return slot > 0 ? (off_t)(slot - 1) : -1;
+}
+
+// Find an active treasure through the index and read it from the open
+// treasure file. Returns 1 if found, 0 otherwise.
+int find_treasure(const char *hunt_id, int fd, int treasure_id, Treasure *treasure, off_t *position) {
+    struct stat file_stat;
+    int format;
+    int attempt;
+    
+    if (fstat(fd, &file_stat) == -1) {
+        perror("Failed to get file stats");
+        return 0;
+    }
+    format = treasure_file_format(fd);
+    
+    for (attempt = 0; attempt < 2; attempt++) {
+        off_t offset = index_lookup(hunt_id, treasure_id, file_stat.st_size);
+        if (offset < 0) {
+            return 0;
+        }
+        
+        if (read_treasure_at(hunt_id, fd, format, offset, treasure) == 0 &&
+            treasure->is_active && treasure->id == treasure_id) {
+            if (position) {
+                *position = offset;
+            }
+            return 1;
+        }
+        
+        // The entry does not match the data: the index is corrupt
+        if (attempt == 0 && rebuild_treasure_index(hunt_id) == -1) {
+            return 0;
+        }
+    }
+    
+    return 0;
+}
+
+// Create a symbolic link to the log file
+void create_symlink(const char *hunt_id) {
+    char log_path[MAX_PATH];
+    char link_path[MAX_PATH] = "./logged_hunt-";
+    
+    strcpy(log_path, HUNT_DIR_PREFIX);
+    strcat(log_path, hunt_id);
+    strcat(log_path, "/logged_hunt");
+    
+    strcat(link_path, hunt_id);
+    
+    create_link(log_path, link_path);
+}
+
+// Log a free-form message to the hunt's log (see log_event() for the
+// operations with their own record type)
+void log_operation(const char *hunt_id, const char *operation) {
+    log_event(hunt_id, LOG_OP_MESSAGE, 0, NULL, 0, operation);
+}
+
+// Get the path to the metadata file for a hunt
+char* get_meta_file_path(const char *hunt_id) {
+    static char meta_path[MAX_PATH];
+    
+    strcpy(meta_path, HUNT_DIR_PREFIX);
+    strcat(meta_path, hunt_id);
+    strcat(meta_path, "/meta");
+    
+    return meta_path;
+}
+
+// Read the metadata block. Returns 0 on success, -1 if it is missing or invalid.
+int read_hunt_meta(const char *hunt_id, HuntMeta *meta) {
+    int fd = open(get_meta_file_path(hunt_id), O_RDONLY);
+    ssize_t bytes_read;
+    
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            perror("Failed to open meta file");
+        }
+        return -1;
+    }
+    
+    bytes_read = read(fd, meta, sizeof(HuntMeta));
+    close(fd);
+    
+    if (bytes_read != sizeof(HuntMeta) ||
+        meta->magic != META_MAGIC || meta->version != META_VERSION) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Atomically replace the metadata block (write a temp file, then rename).
+// Returns 0 on success, -1 on failure.
+int write_hunt_meta(const char *hunt_id, const HuntMeta *meta) {
+    char meta_path[MAX_PATH];
+    char temp_path[MAX_PATH + 24];
+    int fd;
+    
+    // The temp name is per process: readers holding a shared hunt lock may
+    // rebuild the same file at the same time
+    strcpy(meta_path, get_meta_file_path(hunt_id));
+    strcpy(temp_path, meta_path);
+    sprintf(temp_path + strlen(temp_path), ".%d.tmp", (int)getpid());
+    
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Failed to create meta file");
+        return -1;
+    }
+    
+    if (write(fd, meta, sizeof(HuntMeta)) != sizeof(HuntMeta)) {
+        perror("Failed to write meta file");
+        close(fd);
+        unlink(temp_path);
+        return -1;
+    }
+    
+    close(fd);
+    
+    if (rename(temp_path, meta_path) == -1) {
+        perror("Failed to install meta file");
+        unlink(temp_path);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Recompute the metadata block from the treasure file and write it.
+// next_id never goes below the value in an existing block, so IDs of
+// records that no longer exist are not handed out again.
+int rebuild_hunt_meta(const char *hunt_id, HuntMeta *meta) {
+    TreasureScan scan;
+    const Treasure *treasure;
+    HuntMeta old_meta;
+    int max_id = 0;
+    int fd;
+    
+    memset(meta, 0, sizeof(HuntMeta));
+    meta->magic = META_MAGIC;
+    meta->version = META_VERSION;
+    
+    if (read_hunt_meta(hunt_id, &old_meta) == 0) {
+        meta->flags = old_meta.flags;
+        meta->generation = old_meta.generation + 1;
+        max_id = old_meta.next_id - 1;
+    }
+    
+    fd = open(get_treasure_file_path(hunt_id), O_RDONLY);
+    if (fd == -1 && errno != ENOENT) {
+        perror("Failed to open treasure file");
+        return -1;
+    }
+    
+    // Removed records count towards the highest ID so it is not reused
+    if (fd != -1) {
+        meta->data_size = lseek(fd, 0, SEEK_END);
+        if (scan_open(&scan, hunt_id, fd) == -1) {
+            close(fd);
+            return -1;
+        }
+        
+        while ((treasure = scan_next(&scan)) != NULL) {
+            if (treasure->id > max_id) {
+                max_id = treasure->id;
+            }
+            if (treasure->is_active) {
+                meta->active_count++;
+                meta->value_total += treasure->value;
+            }
+            meta->record_count++;
+        }
+        
+        scan_close(&scan);
+        close(fd);
+    }
+    
+    meta->next_id = max_id + 1;
+    
+    // Changes were missed: totals stamped with an old generation can no
+    // longer be trusted, even if the new block happens to reuse it
+    unlink(get_scores_file_path(hunt_id));
+    unlink(get_spatial_index_path(hunt_id));
+    remove_columns(hunt_id);
+    
+    return write_hunt_meta(hunt_id, meta);
+}
+
+// Load the metadata block, rebuilding it if it is missing or does not
+// describe a treasure file of the given size. Returns 0 on success.
+int load_hunt_meta(const char *hunt_id, HuntMeta *meta, off_t data_size) {
+    if (read_hunt_meta(hunt_id, meta) == 0 && meta->data_size == data_size) {
+        return 0;
+    }
+    
+    return rebuild_hunt_meta(hunt_id, meta);
+}
+
+// Get the next available treasure ID
+int get_next_treasure_id(const char *hunt_id) {
+    struct stat file_stat;
+    HuntMeta meta;
+    
+    // If the file doesn't exist, the hunt is empty
+    if (stat(get_treasure_file_path(hunt_id), &file_stat) == -1) {
+        if (errno != ENOENT) {
+            perror("Failed to get file stats");
+            exit(1);
+        }
+        file_stat.st_size = 0;
+    }
+    
+    if (load_hunt_meta(hunt_id, &meta, file_stat.st_size) == -1) {
+        exit(1);
+    }
+    
+    return meta.next_id;
+}
+
+// Account for count active treasures (IDs up to last_id, values summing to
+// value_total) appended at the given offset. data_size is the size of the
+// treasure file after the append. scores holds the per-user totals of the
+// new records and is applied to scores.dat.
+void meta_records_added(const char *hunt_id, int last_id, int64_t count, int64_t value_total,
+                        off_t offset, off_t data_size, const ScoreTable *scores) {
+    HuntMeta meta;
+    uint64_t generation;
+    
+    // A block that does not describe the file before the append is stale;
+    // rebuilding it from the file already accounts for the new records
+    if (read_hunt_meta(hunt_id, &meta) == -1 || meta.data_size != offset) {
+        rebuild_hunt_meta(hunt_id, &meta);
+        return;
+    }
+    
+    generation = meta.generation;
+    if (last_id >= meta.next_id) {
+        meta.next_id = last_id + 1;
+    }
+    meta.record_count += count;
+    meta.active_count += count;
+    meta.value_total += value_total;
+    meta.generation++;
+    meta.data_size = data_size;
+    
+    if (write_hunt_meta(hunt_id, &meta) == 0) {
+        scores_update(hunt_id, scores, generation, meta.generation);
+    }
+}
+
+// Account for a treasure that was marked as removed
+void meta_record_removed(const char *hunt_id, const Treasure *treasure, off_t data_size) {
+    char username[MAX_USERNAME + 1];
+    ScoreTable delta;
+    HuntMeta meta;
+    uint64_t generation;
+    
+    if (read_hunt_meta(hunt_id, &meta) == -1 || meta.data_size != data_size) {
+        rebuild_hunt_meta(hunt_id, &meta);
+        return;
+    }
+    
+    generation = meta.generation;
+    meta.active_count--;
+    meta.value_total -= treasure->value;
+    meta.generation++;
+    
+    if (write_hunt_meta(hunt_id, &meta) == -1) {
+        return;
+    }
+    
+    // Take the treasure out of its owner's totals
+    memcpy(username, treasure->username, MAX_USERNAME);
+    username[MAX_USERNAME] = '\0';
+    if (score_table_init(&delta) == 0 &&
+        score_table_add(&delta, username, -(long long)treasure->value, -1) == 0) {
+        scores_update(hunt_id, &delta, generation, meta.generation);
+    } else {
+        unlink(get_scores_file_path(hunt_id));
+    }
+    score_table_free(&delta);
+    
+    columns_record_removed(hunt_id, treasure->id, generation, meta.generation);
+}
+
+// Get the path to the score file for a hunt
+char* get_scores_file_path(const char *hunt_id) {
+    static char scores_path[MAX_PATH];
+    
+    strcpy(scores_path, HUNT_DIR_PREFIX);
+    strcat(scores_path, hunt_id);
+    strcat(scores_path, "/scores.dat");
+    
+    return scores_path;
+}
+
+// Read the score file into a new table and return the generation it was
+// written for. Returns 0 on success, -1 if it is missing or invalid (the
+// table is left empty).
+int read_hunt_scores(const char *hunt_id, ScoreTable *table, uint64_t *generation) {
+    ScoreEntry entries[SCAN_BUFFER_RECORDS];
+    char username[MAX_USERNAME + 1];
+    ScoresHeader header;
+    int64_t remaining;
+    int fd;
+    
+    if (score_table_init(table) == -1) {
+        return -1;
+    }
+    
+    fd = open(get_scores_file_path(hunt_id), O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            perror("Failed to open score file");
+        }
+        return -1;
+    }
+    
+    if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+        header.magic != SCORES_MAGIC || header.version != SCORES_VERSION) {
+        close(fd);
+        return -1;
+    }
+    
+    remaining = header.user_count;
+    while (remaining > 0) {
+        size_t wanted = remaining < SCAN_BUFFER_RECORDS ? (size_t)remaining : SCAN_BUFFER_RECORDS;
+        ssize_t bytes_read = read(fd, entries, wanted * sizeof(ScoreEntry));
+        
+        if (bytes_read != (ssize_t)(wanted * sizeof(ScoreEntry))) {
+            break;
+        }
+        
+        for (size_t i = 0; i < wanted; i++) {
+            memcpy(username, entries[i].username, MAX_USERNAME);
+            username[MAX_USERNAME] = '\0';
+            if (score_table_add(table, username, entries[i].score, entries[i].count) == -1) {
+                break;
+            }
+        }
+        remaining -= wanted;
+    }
+    close(fd);
+    
+    if (remaining > 0 || table->user_count != (size_t)header.user_count) {
+        score_table_free(table);
+        score_table_init(table);
+        return -1;
+    }
+    
+    *generation = header.generation;
+    return 0;
+}
+
+// Atomically replace the score file with the users of the table that
+// still have active treasures. Returns 0 on success, -1 on failure.
+int write_hunt_scores(const char *hunt_id, const ScoreTable *table, uint64_t generation) {
+    char scores_path[MAX_PATH];
+    char temp_path[MAX_PATH + 24];
+    ScoresHeader header;
+    ScoreEntry entry;
+    OutBuf out;
+    int fd;
+    
+    strcpy(scores_path, get_scores_file_path(hunt_id));
+    strcpy(temp_path, scores_path);
+    sprintf(temp_path + strlen(temp_path), ".%d.tmp", (int)getpid());
+    
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Failed to create score file");
+        return -1;
+    }
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = SCORES_MAGIC;
+    header.version = SCORES_VERSION;
+    header.generation = generation;
+    for (size_t i = 0; i < table->user_count; i++) {
+        if (table->users[i].count > 0) {
+            header.user_count++;
+        }
+    }
+    
+    outbuf_init(&out, fd);
+    outbuf_write(&out, &header, sizeof(header));
+    for (size_t i = 0; i < table->user_count; i++) {
+        if (table->users[i].count <= 0) {
+            continue;
+        }
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.username, table->users[i].name, MAX_USERNAME - 1);
+        entry.score = table->users[i].score;
+        entry.count = table->users[i].count;
+        outbuf_write(&out, &entry, sizeof(entry));
+    }
+    
+    if (outbuf_flush(&out) == -1) {
+        close(fd);
+        unlink(temp_path);
+        return -1;
+    }
+    close(fd);
+    
+    if (rename(temp_path, scores_path) == -1) {
+        perror("Failed to install score file");
+        unlink(temp_path);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Sum the active records of a version 3 scan into table, keyed by user ID
+// while scanning. Returns 0 on success, -1 if out of memory.
+static int rebuild_scores_by_user_id(TreasureScan *scan, ScoreTable *table) {
+    const Treasure *treasure;
+    long long *totals = NULL;      // Score and count of user ID i at 2 * i
+    size_t user_count = 0;
+    char username[MAX_USERNAME];
+    int result = 0;
+    
+    scan->resolve_names = 0;
+    while ((treasure = scan_next(scan)) != NULL) {
+        if (!treasure->is_active) {
+            continue;
+        }
+        
+        if (scan->user_id >= user_count) {
+            size_t new_count = user_count ? user_count : 1024;
+            while (new_count <= scan->user_id) {
+                new_count *= 2;
+            }
+            long long *grown = realloc(totals, new_count * 2 * sizeof(long long));
+            if (!grown) {
+                perror("Failed to allocate user totals");
+                free(totals);
+                return -1;
+            }
+            memset(grown + user_count * 2, 0, (new_count - user_count) * 2 * sizeof(long long));
+            totals = grown;
+            user_count = new_count;
+        }
+        totals[scan->user_id * 2] += treasure->value;
+        totals[scan->user_id * 2 + 1]++;
+    }
+    
+    for (size_t i = 0; i < user_count && result == 0; i++) {
+        if (totals[i * 2 + 1] == 0) {
+            continue;
+        }
+        resolve_username(&scan->dict, scan->hunt_id, (uint32_t)i, username);
+        if (score_table_add(table, username, totals[i * 2], totals[i * 2 + 1]) == -1) {
+            perror("Failed to allocate user");
+            result = -1;
+        }
+    }
+    
+    free(totals);
+    return result;
+}
+
+// Recompute the per-user totals from the treasure file into a new table
+// and write them as the score file of the given generation
+int rebuild_hunt_scores(const char *hunt_id, ScoreTable *table, uint64_t generation) {
+    char username[MAX_USERNAME + 1];
+    TreasureScan scan;
+    const Treasure *treasure;
+    ColumnSet columns;
+    int fd;
+    
+    if (score_table_init(table) == -1) {
+        perror("Failed to allocate score table");
+        return -1;
+    }
+    
+    // The columnar layout has the two needed columns without the clues
+    if (columns_open(hunt_id, COLUMN_VALUE | COLUMN_ACTIVE | COLUMN_USERNAME, &columns) == 0) {
+        for (int64_t row = 0; row < columns.header.row_count; row++) {
+            if (COLUMN_ROW_ACTIVE(&columns, row) &&
+                score_table_add(table, columns.username_heap + columns.username_offsets[row],
+                                columns.values[row], 1) == -1) {
+                perror("Failed to allocate user");
+                columns_close(&columns);
+                return -1;
+            }
+        }
+        columns_close(&columns);
+        write_hunt_scores(hunt_id, table, generation);
+        return 0;
+    }
+    
+    fd = open(get_treasure_file_path(hunt_id), O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            perror("Failed to open treasure file");
+            return -1;
+        }
+        return 0;
+    }
+    
+    if (scan_open(&scan, hunt_id, fd) == -1) {
+        perror("Failed to read treasure file");
+        close(fd);
+        return -1;
+    }
+    
+    // Owners are dictionary IDs: sum per ID, then name the users once
+    if (scan.format == TREASURE_FORMAT_V3) {
+        int result = rebuild_scores_by_user_id(&scan, table);
+        
+        scan_close(&scan);
+        close(fd);
+        if (result == 0) {
+            write_hunt_scores(hunt_id, table, generation);
+        }
+        return result;
+    }
+    
+    while ((treasure = scan_next(&scan)) != NULL) {
+        if (!treasure->is_active) {
+            continue;
+        }
+        
+        // Records may fill the whole name field without a terminator
+        memcpy(username, treasure->username, MAX_USERNAME);
+        username[MAX_USERNAME] = '\0';
+        
+        if (score_table_add(table, username, treasure->value, 1) == -1) {
+            perror("Failed to allocate user");
+            scan_close(&scan);
+            close(fd);
+            return -1;
+        }
+    }
+    
+    scan_close(&scan);
+    close(fd);
+    
+    // A failed write only costs the next reader another scan
+    write_hunt_scores(hunt_id, table, generation);
+    return 0;
+}
+
+// Load the per-user totals of a hunt into a new table: from scores.dat
+// when it matches the current meta generation, otherwise recomputed from
+// treasures.dat. Returns 0 on success, -1 on error.
+int load_hunt_scores(const char *hunt_id, ScoreTable *table) {
+    struct stat file_stat;
+    HuntMeta meta;
+    uint64_t generation;
+    int status;
+    
+    if (lock_hunt(hunt_id, HUNT_LOCK_READ) == -1) {
+        return -1;
+    }
+    
+    // A hunt without a treasure file has no scores yet
+    if (stat(get_treasure_file_path(hunt_id), &file_stat) == -1) {
+        unlock_hunt(hunt_id);
+        if (errno != ENOENT) {
+            perror("Failed to get file stats");
+            return -1;
+        }
+        return score_table_init(table);
+    }
+    
+    if (load_hunt_meta(hunt_id, &meta, file_stat.st_size) == -1) {
+        unlock_hunt(hunt_id);
+        return -1;
+    }
+    
+    if (read_hunt_scores(hunt_id, table, &generation) == 0 && generation == meta.generation) {
+        unlock_hunt(hunt_id);
+        return 0;
+    }
+    score_table_free(table);
+    
+    status = rebuild_hunt_scores(hunt_id, table, meta.generation);
+    unlock_hunt(hunt_id);
+    return status;
+}
+
+// open_hunt_scores() with the hunt's read lock held
+static int open_hunt_scores_locked(const char *hunt_id, ScoresHeader *header) {
+    struct stat file_stat;
+    ScoreTable table;
+    HuntMeta meta;
+    int fd;
+    
+    if (stat(get_treasure_file_path(hunt_id), &file_stat) == -1) {
+        if (errno != ENOENT) {
+            perror("Failed to get file stats");
+            return -1;
+        }
+        return -2;
+    }
+    
+    if (load_hunt_meta(hunt_id, &meta, file_stat.st_size) == -1) {
+        return -1;
+    }
+    
+    for (int attempt = 0; attempt < 2; attempt++) {
+        fd = open(get_scores_file_path(hunt_id), O_RDONLY);
+        if (fd != -1) {
+            if (read(fd, header, sizeof(ScoresHeader)) == sizeof(ScoresHeader) &&
+                header->magic == SCORES_MAGIC && header->version == SCORES_VERSION &&
+                header->generation == meta.generation) {
+                return fd;
+            }
+            close(fd);
+        }
+        
+        // Missing or stale: recompute it once
+        if (attempt == 0) {
+            if (rebuild_hunt_scores(hunt_id, &table, meta.generation) == -1) {
+                score_table_free(&table);
+                return -1;
+            }
+            score_table_free(&table);
+        }
+    }
+    
+    fprintf(stderr, "Failed to write score file for hunt '%s'\n", hunt_id);
+    return -1;
+}
+
+// Open the hunt's score file for streaming, recomputing it first if it is
+// missing or stale. Returns an fd positioned at the first ScoreEntry with
+// the header filled in, or -1 on error (or -2 if the hunt has no treasure
+// file, in which case there are no scores).
+int open_hunt_scores(const char *hunt_id, ScoresHeader *header) {
+    int fd;
+    
+    // The open file stays readable even if a writer replaces it later
+    if (lock_hunt(hunt_id, HUNT_LOCK_READ) == -1) {
+        return -1;
+    }
+    fd = open_hunt_scores_locked(hunt_id, header);
+    unlock_hunt(hunt_id);
+    
+    return fd;
+}
+
+// Move the score file from generation to new_generation, adding the
+// per-user totals in delta (NULL when the totals did not change). A file
+// that does not belong to generation is stale and is dropped instead.
+void scores_update(const char *hunt_id, const ScoreTable *delta, uint64_t generation,
+                   uint64_t new_generation) {
+    ScoreTable table;
+    uint64_t file_generation;
+    
+    if (read_hunt_scores(hunt_id, &table, &file_generation) == -1 ||
+        file_generation != generation) {
+        score_table_free(&table);
+        unlink(get_scores_file_path(hunt_id));
+        return;
+    }
+    
+    for (size_t i = 0; delta && i < delta->user_count; i++) {
+        const UserScore *user = &delta->users[i];
+        if (score_table_add(&table, user->name, user->score, user->count) == -1) {
+            score_table_free(&table);
+            unlink(get_scores_file_path(hunt_id));
+            return;
+        }
+    }
+    
+    if (write_hunt_scores(hunt_id, &table, new_generation) == -1) {
+        unlink(get_scores_file_path(hunt_id));
+    }
+    score_table_free(&table);
+}
+
+// Get a read-only fd for the hunt's treasure file from the open file
+// cache. The fd is owned by the cache and must not be closed by the
+// caller. An entry is reopened when the file was replaced (for example by
+// compaction). Returns -1 with errno set if the file cannot be opened.
+int open_treasure_file(const char *hunt_id) {
+    char *file_path = get_treasure_file_path(hunt_id);
+    OpenTreasureFile *entry = NULL;
+    struct stat file_stat;
+    int i;
+    
+    for (i = 0; i < OPEN_FILE_CACHE_SIZE; i++) {
+        if (open_files[i].fd > 0 && strcmp(open_files[i].hunt_id, hunt_id) == 0) {
+            entry = &open_files[i];
+            break;
+        }
+    }
+    
+    if (stat(file_path, &file_stat) == -1) {
+        int saved_errno = errno;
+        
+        if (entry) {
+            close(entry->fd);
+            entry->fd = 0;
+        }
+        errno = saved_errno;
+        return -1;
+    }
+    
+    if (entry && entry->dev == file_stat.st_dev && entry->ino == file_stat.st_ino) {
+        return entry->fd;
+    }
+    
+    // Not cached or stale: (re)open into this hunt's slot or the next one
+    if (!entry) {
+        entry = &open_files[open_files_next];
+        open_files_next = (open_files_next + 1) % OPEN_FILE_CACHE_SIZE;
+    }
+    if (entry->fd > 0) {
+        close(entry->fd);
+        entry->fd = 0;
+    }
+    
+    int fd = open(file_path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &file_stat) == -1) {
+        close(fd);
+        return -1;
+    }
+    
+    strcpy(entry->hunt_id, hunt_id);
+    entry->fd = fd;
+    entry->dev = file_stat.st_dev;
+    entry->ino = file_stat.st_ino;
+    
+    return fd;
+}
+
+// Close every cached treasure file
+void close_treasure_files(void) {
+    int i;
+    
+    for (i = 0; i < OPEN_FILE_CACHE_SIZE; i++) {
+        if (open_files[i].fd > 0) {
+            close(open_files[i].fd);
+            open_files[i].fd = 0;
+        }
+    }
+}
+
+// List all hunts with the number of active treasures in each
+int list_hunts(void) {
+    DIR *dir;
+    struct dirent *entry;
+    struct stat file_stat;
+    HuntMeta meta;
+    OutBuf out;
+    int count = 0;
+    
+    outbuf_init(&out, STDOUT_FILENO);
+    
+    dir = opendir(HUNT_DIR_PREFIX);
+    if (!dir) {
+        if (errno == ENOENT) {
+            outbuf_printf(&out, "No hunts found.\n");
+            outbuf_flush(&out);
+            return 0;
+        }
+        perror("Failed to open hunts directory");
+        return -1;
+    }
+    
+    outbuf_printf(&out, "Hunts:\n");
+    outbuf_printf(&out, "--------------------------------------------------\n");
+    
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        
+        // The counters come from the meta block, not from a scan. A stale
+        // block is rebuilt, so a writer must not be half way through.
+        if (lock_hunt(entry->d_name, HUNT_LOCK_READ) == -1) {
+            continue;
+        }
+        if (stat(get_treasure_file_path(entry->d_name), &file_stat) == -1) {
+            file_stat.st_size = 0;
+        }
+        if (load_hunt_meta(entry->d_name, &meta, file_stat.st_size) == -1) {
+            unlock_hunt(entry->d_name);
+            continue;
+        }
+        unlock_hunt(entry->d_name);
+        
+        outbuf_printf(&out, "Hunt: %s | Treasures: %lld\n", entry->d_name, (long long)meta.active_count);
+        count++;
+    }
+    
+    closedir(dir);
+    
+    if (count == 0) {
+        outbuf_printf(&out, "No hunts found.\n");
+    }
+    outbuf_printf(&out, "--------------------------------------------------\n");
+    outbuf_printf(&out, "Total hunts: %d\n", count);
+    outbuf_flush(&out);
+    
+    return 0;
+}
+
+// List all treasures in a hunt. Returns 0 on success, -1 on error.
+int list_treasures(const char *hunt_id) {
+    int fd;
+    TreasureScan scan;
+    const Treasure *treasure;
+    ColumnSet columns;
+    struct stat file_stat;
+    OutBuf out;
+    char time_str[30];
+    int count = 0;
+    
+    // Writers wait until the listing is done
+    if (lock_hunt(hunt_id, HUNT_LOCK_READ) == -1) {
+        return -1;
+    }
+    
+    // Get the treasure file from the open file cache
+    outbuf_init(&out, STDOUT_FILENO);
+    fd = open_treasure_file(hunt_id);
+    if (fd == -1) {
+        unlock_hunt(hunt_id);
+        if (errno == ENOENT) {
+            outbuf_printf(&out, "Hunt '%s' has no treasures or does not exist.\n", hunt_id);
+            outbuf_flush(&out);
+            return 0;
+        }
+        perror("Failed to open treasure file");
+        return -1;
+    }
+    
+    // Get file stats
+    if (fstat(fd, &file_stat) == -1) {
+        perror("Failed to get file stats");
+        unlock_hunt(hunt_id);
+        return -1;
+    }
+    
+    // Format the last modification time
+    format_time(file_stat.st_mtime, time_str);
+    
+    // Print hunt information
+    outbuf_printf(&out, "Hunt: %s\n", hunt_id);
+    outbuf_printf(&out, "Total file size: %ld bytes\n", (long)file_stat.st_size);
+    outbuf_printf(&out, "Last modified: %s\n\n", time_str);
+    outbuf_printf(&out, "Treasures:\n");
+    outbuf_printf(&out, "--------------------------------------------------\n");
+    
+    // With a current columnar layout only the listed columns are read
+    if (columns_open(hunt_id, COLUMN_ID | COLUMN_VALUE | COLUMN_ACTIVE | COLUMN_USERNAME,
+                     &columns) == 0) {
+        for (int64_t row = 0; row < columns.header.row_count; row++) {
+            if (COLUMN_ROW_ACTIVE(&columns, row)) {
+                outbuf_printf(&out, "ID: %d | User: %s | Value: %d\n", columns.ids[row],
+                              columns.username_heap + columns.username_offsets[row],
+                              columns.values[row]);
+                count++;
+            }
+        }
+        columns_close(&columns);
+    } else {
+        // Walk all records and print the active ones
+        if (scan_open(&scan, hunt_id, fd) == -1) {
+            outbuf_flush(&out);
+            unlock_hunt(hunt_id);
+            return -1;
+        }
+        
+        while ((treasure = scan_next(&scan)) != NULL) {
+            if (treasure->is_active) {
+                outbuf_printf(&out, "ID: %d | User: %s | Value: %d\n", 
+                       treasure->id, treasure->username, treasure->value);
+                count++;
+            }
+        }
+        
+        scan_close(&scan);
+    }
+    
+    if (count == 0) {
+        outbuf_printf(&out, "No active treasures found in this hunt.\n");
+    }
+    
+    outbuf_printf(&out, "--------------------------------------------------\n");
+    outbuf_printf(&out, "Total treasures: %d\n", count);
+    outbuf_flush(&out);
+    
+    // Log the operation
+    log_event(hunt_id, LOG_OP_LIST, 0, NULL, 0, NULL);
+    
+    unlock_hunt(hunt_id);
+    return 0;
+}
+
+// View details of a specific treasure. Returns 0 on success, -1 on error.
+int view_treasure(const char *hunt_id, int treasure_id) {
+    int fd;
+    Treasure treasure;
+    ColumnSet columns;
+    int found = 0;
+    OutBuf out;
+    
+    if (lock_hunt(hunt_id, HUNT_LOCK_READ) == -1) {
+        return -1;
+    }
+    
+    // Get the treasure file from the open file cache
+    outbuf_init(&out, STDOUT_FILENO);
+    fd = open_treasure_file(hunt_id);
+    if (fd == -1) {
+        unlock_hunt(hunt_id);
+        if (errno == ENOENT) {
+            outbuf_printf(&out, "Hunt '%s' has no treasures or does not exist.\n", hunt_id);
+            outbuf_flush(&out);
+            return 0;
+        }
+        perror("Failed to open treasure file");
+        return -1;
+    }
+    
+    // Look up the treasure in the ID column, or through the ID index
+    if (columns_open(hunt_id, COLUMN_ALL, &columns) == 0) {
+        int64_t row = columns_find_row(&columns, treasure_id);
+        
+        found = row != -1;
+        if (found) {
+            columns_get_treasure(&columns, row, &treasure);
+        }
+        columns_close(&columns);
+    } else {
+        found = find_treasure(hunt_id, fd, treasure_id, &treasure, NULL);
+    }
+    
+    if (found) {
+        outbuf_printf(&out, "Treasure Details:\n");
+        outbuf_printf(&out, "--------------------------------------------------\n");
+        outbuf_printf(&out, "ID: %d\n", treasure.id);
+        outbuf_printf(&out, "User: %s\n", treasure.username);
+        outbuf_printf(&out, "Location: %.6f, %.6f\n", treasure.latitude, treasure.longitude);
+        outbuf_printf(&out, "Clue: %s\n", treasure.clue);
+        outbuf_printf(&out, "Value: %d\n", treasure.value);
+        outbuf_printf(&out, "--------------------------------------------------\n");
+        outbuf_flush(&out);
+        
+        // Log the operation
+        log_event(hunt_id, LOG_OP_VIEW, treasure_id, treasure.username, 0, NULL);
+    } else {
+        outbuf_printf(&out, "Treasure with ID %d not found in hunt '%s'.\n", treasure_id, hunt_id);
+        outbuf_flush(&out);
+    }
+    
+    unlock_hunt(hunt_id);
+    return 0;
+}
+
+// Remove a treasure from a hunt. Returns 0 on success, -1 on error.
+int remove_treasure(const char *hunt_id, int treasure_id) {
+    char *file_path = get_treasure_file_path(hunt_id);
+    int fd;
+    Treasure treasure;
+    off_t position;
+    int found = 0;
+    int format;
+    
+    if (lock_hunt(hunt_id, HUNT_LOCK_WRITE) == -1) {
+        return -1;
+    }
+    
+    // Open the treasure file for reading and writing
+    fd = open(file_path, O_RDWR);
+    if (fd == -1) {
+        unlock_hunt(hunt_id);
+        if (errno == ENOENT) {
+            printf("Hunt '%s' has no treasures or does not exist.\n", hunt_id);
+            return 0;
+        }
+        perror("Failed to open treasure file");
+        return -1;
+    }
+    
+    // Look up the treasure through the ID index
+    found = find_treasure(hunt_id, fd, treasure_id, &treasure, &position);
+    
+    if (found) {
+        // Mark the treasure as inactive in place
+        treasure.is_active = 0;
+        format = treasure_file_format(fd);
+        if (journal_begin(hunt_id, JOURNAL_OP_REMOVE, treasure_id, format, position) == -1 ||
+            mark_treasure_removed(fd, format, position) == -1) {
+            perror("Failed to update treasure");
+            close(fd);
+            unlock_hunt(hunt_id);
+            return -1;
+        }
+        
+        off_t data_size = lseek(fd, 0, SEEK_END);
+        index_remove_entry(hunt_id, treasure_id, data_size);
+        meta_record_removed(hunt_id, &treasure, data_size);
+        journal_commit(hunt_id, fd);
+    }
+    
+    close(fd);
+    
+    if (found) {
+        printf("Treasure with ID %d removed successfully.\n", treasure_id);
+        
+        // Log the operation
+        log_event(hunt_id, LOG_OP_REMOVE, treasure_id, treasure.username, 0, NULL);
+        
+        // Compact once the share of removed records passes the hunt's limit
+        HuntMeta meta;
+        if (read_hunt_meta(hunt_id, &meta) == 0 && (meta.flags & META_COMPACT_PCT_MASK) != 0 &&
+            (meta.record_count - meta.active_count) * 100 >=
+                (int64_t)(meta.flags & META_COMPACT_PCT_MASK) * meta.record_count) {
+            compact_hunt(hunt_id, (meta.flags & META_COMPACT_PCT_MASK) / 100.0);
+        }
+    } else {
+        printf("Treasure with ID %d not found in hunt '%s'.\n", treasure_id, hunt_id);
+    }
+    
+    unlock_hunt(hunt_id);
+    return 0;
+}
+
+// Compaction with the hunt's write lock held
+static long long compact_hunt_locked(const char *hunt_id, double threshold) {
+    char file_path[MAX_PATH];
+    char temp_path[MAX_PATH + 8];
+    Treasure batch[SCAN_BUFFER_RECORDS];
+    char encoded[SCAN_BUFFER_RECORDS * sizeof(Treasure)];
+    size_t batch_count = 0;
+    size_t encoded_len;
+    TreasureScan scan;
+    const Treasure *treasure;
+    struct stat file_stat;
+    TreasureFileHeader header;
+    HuntMeta meta;
+    int64_t kept = 0;
+    int64_t value_total = 0;
+    off_t out_size = 0;
+    long long reclaimed;
+    int fd, out_fd, format;
+    
+    strcpy(file_path, get_treasure_file_path(hunt_id));
+    strcpy(temp_path, file_path);
+    strcat(temp_path, ".tmp");
+    
+    fd = open(file_path, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            printf("Hunt '%s' has no treasures or does not exist.\n", hunt_id);
+            return 0;
+        }
+        perror("Failed to open treasure file");
+        return -1;
+    }
+    
+    if (fstat(fd, &file_stat) == -1 || load_hunt_meta(hunt_id, &meta, file_stat.st_size) == -1) {
+        perror("Failed to read hunt state");
+        close(fd);
+        return -1;
+    }
+    
+    // Decide from the counters whether compaction is worth it. A plain
+    // compaction also rewrites a version 1 file in the current format.
+    int64_t removed = meta.record_count - meta.active_count;
+    format = treasure_file_format(fd);
+    if ((removed == 0 && format == TREASURE_FORMAT_CURRENT) || removed < threshold * meta.record_count) {
+        printf("Hunt '%s': %lld of %lld records removed; nothing to compact.\n",
+               hunt_id, (long long)removed, (long long)meta.record_count);
+        close(fd);
+        return 0;
+    }
+    
+    out_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd == -1) {
+        perror("Failed to create compacted file");
+        close(fd);
+        return -1;
+    }
+    
+    header.magic = TREASURE_FILE_MAGIC;
+    header.version = TREASURE_FORMAT_CURRENT;
+    if (write(out_fd, &header, sizeof(header)) != sizeof(header) || scan_open(&scan, hunt_id, fd) == -1) {
+        close(out_fd);
+        unlink(temp_path);
+        close(fd);
+        return -1;
+    }
+    out_size = sizeof(header);
+    
+    // Copy the active records in large batches
+    while ((treasure = scan_next(&scan)) != NULL) {
+        if (!treasure->is_active) {
+            continue;
+        }
+        
+        batch[batch_count++] = *treasure;
+        kept++;
+        value_total += treasure->value;
+        
+        if (batch_count == SCAN_BUFFER_RECORDS) {
+            encoded_len = encode_treasures(hunt_id, TREASURE_FORMAT_CURRENT, batch, batch_count, encoded, 0, NULL);
+            if (encoded_len == 0 || write(out_fd, encoded, encoded_len) != (ssize_t)encoded_len) {
+                break;
+            }
+            out_size += encoded_len;
+            batch_count = 0;
+        }
+    }
+    
+    scan_close(&scan);
+    close(fd);
+    
+    encoded_len = encode_treasures(hunt_id, TREASURE_FORMAT_CURRENT, batch, batch_count, encoded, 0, NULL);
+    if (treasure != NULL || (batch_count > 0 && encoded_len == 0) ||
+        write(out_fd, encoded, encoded_len) != (ssize_t)encoded_len ||
+        fsync(out_fd) == -1) {
+        perror("Failed to write compacted file");
+        close(out_fd);
+        unlink(temp_path);
+        return -1;
+    }
+    
+    close(out_fd);
+    
+    if (rename(temp_path, file_path) == -1) {
+        perror("Failed to install compacted file");
+        unlink(temp_path);
+        return -1;
+    }
+    
+    // Record offsets changed: refresh the counters and the index
+    out_size += encoded_len;
+    reclaimed = (long long)file_stat.st_size - (long long)out_size;
+    meta.record_count = kept;
+    meta.active_count = kept;
+    meta.value_total = value_total;
+    meta.data_size = out_size;
+    meta.generation++;
+    if (write_hunt_meta(hunt_id, &meta) == 0) {
+        // Only removed records were dropped: the totals carry over
+        scores_update(hunt_id, NULL, meta.generation - 1, meta.generation);
+    }
+    rebuild_treasure_index(hunt_id);
+    
+    // Rows moved too: convert the columnar layout again if there is one
+    if (columns_exist(hunt_id)) {
+        convert_to_columns(hunt_id);
+    }
+    
+    printf("Compacted hunt '%s': dropped %lld removed records, reclaimed %lld bytes.\n",
+           hunt_id, (long long)removed, reclaimed);
+    
+    log_event(hunt_id, LOG_OP_COMPACT, 0, NULL, reclaimed, NULL);
+    
+    return reclaimed;
+}
+
+// Rewrite the treasure file without removed records. The new file is
+// written next to the old one and renamed over it, so readers see either
+// the old or the new file. Nothing is done if the share of removed
+// records is below threshold (0..1). Returns the bytes reclaimed, or -1.
+long long compact_hunt(const char *hunt_id, double threshold) {
+    long long reclaimed;
+    
+    if (lock_hunt(hunt_id, HUNT_LOCK_WRITE) == -1) {
+        return -1;
+    }
+    reclaimed = compact_hunt_locked(hunt_id, threshold);
+    unlock_hunt(hunt_id);
+    
+    return reclaimed;
+}
+
+// Set the share of removed records (0..1) at which remove_treasure()
+// compacts the hunt automatically. 0 turns automatic compaction off.
+void set_auto_compact(const char *hunt_id, double threshold) {
+    struct stat file_stat;
+    HuntMeta meta;
+    int percent = (int)(threshold * 100.0 + 0.5);
+    
+    if (threshold < 0.0 || threshold > 1.0) {
+        printf("Threshold must be between 0 and 1.\n");
+        return;
+    }
+    
+    if (stat(get_treasure_file_path(hunt_id), &file_stat) == -1) {
+        printf("Hunt '%s' has no treasures or does not exist.\n", hunt_id);
+        return;
+    }
+    
+    if (lock_hunt(hunt_id, HUNT_LOCK_WRITE) == -1) {
+        return;
+    }
+    if (load_hunt_meta(hunt_id, &meta, file_stat.st_size) == -1) {
+        unlock_hunt(hunt_id);
+        return;
+    }
+    
+    // Never compact an empty hunt on every remove
+    if (threshold > 0.0 && percent == 0) {
+        percent = 1;
+    }
+    
+    meta.flags = (meta.flags & ~META_COMPACT_PCT_MASK) | (uint32_t)percent;
+    if (write_hunt_meta(hunt_id, &meta) == 0) {
+        if (percent) {
+            printf("Hunt '%s' will be compacted once %d%% of its records are removed.\n", hunt_id, percent);
+        } else {
+            printf("Automatic compaction disabled for hunt '%s'.\n", hunt_id);
+        }
+    }
+    
+    unlock_hunt(hunt_id);
+}
+
+// Remove a hunt
+void remove_hunt(const char *hunt_id) {
+    char hunt_path[MAX_PATH];
+    char treasure_file[MAX_PATH];
+    char log_file[MAX_PATH];
+    char index_file[MAX_PATH];
+    char meta_file[MAX_PATH];
+    char scores_file[MAX_PATH];
+    char symlink_path[MAX_PATH] = "./logged_hunt-";
+    
+    // Construct paths
+    strcpy(hunt_path, HUNT_DIR_PREFIX);
+    strcat(hunt_path, hunt_id);
+    
+    strcpy(treasure_file, hunt_path);
+    strcat(treasure_file, "/treasures.dat");
+    
+    strcpy(log_file, hunt_path);
+    strcat(log_file, "/logged_hunt");
+    
+    strcpy(index_file, hunt_path);
+    strcat(index_file, "/treasures.idx");
+    
+    strcpy(meta_file, hunt_path);
+    strcat(meta_file, "/meta");
+    
+    strcpy(scores_file, hunt_path);
+    strcat(scores_file, "/scores.dat");
+    
+    strcat(symlink_path, hunt_id);
+    
+    // Wait for the hunt's readers and writers
+    if (lock_hunt(hunt_id, HUNT_LOCK_WRITE) == -1) {
+        return;
+    }
+    
+    // Log the operation before removing the hunt
+    log_event(hunt_id, LOG_OP_REMOVE_HUNT, 0, NULL, 0, NULL);
+    
+    // Remove the treasure file
+    delete_file(treasure_file);
+    
+    // Remove the ID index
+    delete_file(index_file);
+    
+    // Remove the metadata block
+    delete_file(meta_file);
+    
+    // Remove the score file
+    delete_file(scores_file);
+    
+    // Remove the spatial index
+    delete_file(get_spatial_index_path(hunt_id));
+    
+    // Remove the columnar layout
+    remove_columns(hunt_id);
+    
+    // Remove the user dictionary
+    user_dict_remove(hunt_id);
+    
+    // Remove the log file, writing out what is still buffered first
+    log_close_hunt(hunt_id);
+    delete_file(log_file);
+    delete_file(get_oplog_path(hunt_id));
+    delete_file(get_oplog_index_path(hunt_id));
+    
+    // Remove the symlink
+    delete_file(symlink_path);
+    
+    // Remove the journal and the lock file; processes waiting on the lock
+    // notice that it was unlinked and find the hunt gone
+    delete_file(get_journal_path(hunt_id));
+    delete_file(get_lock_file_path(hunt_id));
+    unlock_hunt(hunt_id);
+    
+    // Remove the hunt directory
+    if (rmdir(hunt_path) == -1) {
+        if (errno == ENOENT) {
+            printf("Hunt '%s' does not exist.\n", hunt_id);
+            return;
+        } else if (errno == ENOTEMPTY) {
+            printf("Hunt directory is not empty. Some files may need to be removed manually.\n");
+        } else {
+            perror("Failed to remove hunt directory");
+        }
+    } else {
+        printf("Hunt '%s' removed successfully.\n", hunt_id);
+    }
+}
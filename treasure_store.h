@@ -0,0 +1,198 @@
+#ifndef TREASURE_STORE_H
+#define TREASURE_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "score_table.h"
+#include "user_dict.h"
+
+#define MAX_PATH 256
+#define MAX_USERNAME 64
+#define MAX_CLUE 256
+#define HUNT_DIR_PREFIX "./hunts/"  // Directory prefix for hunts
+#define INDEX_MAGIC 0x58444954      // "TIDX"
+#define INDEX_VERSION 1
+#define META_MAGIC 0x54454D54       // "TMET"
+#define META_VERSION 1
+#define META_COMPACT_PCT_MASK 0xFFu // Meta flags: auto-compaction threshold in percent (0 = off)
+#define META_LOG_SYNC_SHIFT 8       // Meta flags: log sync policy (LOG_SYNC_* in hunt_log.h)
+#define META_LOG_SYNC_MASK (0x3u << META_LOG_SYNC_SHIFT)
+#define META_LOG_BINARY 0x400u      // Meta flags: log to oplog.bin instead of logged_hunt
+#define META_JOURNALED 0x800u       // Meta flags: add and remove go through the journal
+#define SCORES_MAGIC 0x52435354     // "TSCR"
+#define SCORES_VERSION 1
+#define SCAN_BUFFER_RECORDS 256     // Records per read() when mmap is unavailable
+#define TREASURE_FILE_MAGIC 0x32525454 // "TTR2"
+#define TREASURE_FORMAT_V1 1        // Headerless array of fixed-size Treasure records
+#define TREASURE_FORMAT_V2 2        // File header, then variable-length records
+#define TREASURE_FORMAT_V3 3        // As version 2, with usernames replaced by dictionary IDs
+#define TREASURE_FORMAT_CURRENT TREASURE_FORMAT_V3  // Format of new treasure files
+#define SCAN_NO_USER_ID UINT32_MAX  // TreasureScan.user_id of records without a user ID
+
+// Structure for a treasure record (fixed size)
+typedef struct {
+    int id;                        // Treasure ID
+    char username[MAX_USERNAME];   // User name
+    float latitude;                // GPS latitude
+    float longitude;               // GPS longitude
+    char clue[MAX_CLUE];           // Clue text
+    int value;                     // Value of the treasure
+    char is_active;                // 1 for active or 0 for deleted
+} Treasure;
+
+// Header of a version 2 or 3 treasure file. Version 1 files have no header
+// and are told apart by the missing magic.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} TreasureFileHeader;
+
+// Version 2 record: this fixed part is followed by the username and the
+// clue (without terminators), padded to a multiple of 4 bytes
+typedef struct {
+    int32_t id;
+    float latitude;
+    float longitude;
+    int32_t value;
+    uint8_t is_active;             // Kept first after the numbers, so removal rewrites one byte
+    uint8_t username_len;
+    uint16_t clue_len;
+} TreasureRecordV2;
+
+// Version 3 record: the owner is an ID in the hunt's user dictionary
+// (users.dict), and only the clue follows, padded to a multiple of 4 bytes
+typedef struct {
+    int32_t id;
+    float latitude;
+    float longitude;
+    int32_t value;
+    uint32_t user_id;
+    uint8_t is_active;
+    uint8_t reserved;
+    uint16_t clue_len;
+} TreasureRecordV3;
+
+#define TREASURE_RECORD_V2_SIZE(username_len, clue_len) \
+    ((sizeof(TreasureRecordV2) + (username_len) + (clue_len) + 3) & ~(size_t)3)
+#define TREASURE_RECORD_V3_SIZE(clue_len) \
+    ((sizeof(TreasureRecordV3) + (clue_len) + 3) & ~(size_t)3)
+#define TREASURE_RECORD_MAX TREASURE_RECORD_V2_SIZE(MAX_USERNAME - 1, MAX_CLUE - 1)  // Largest of all formats
+
+// Header of the per-hunt ID index (treasures.idx). It is followed by one
+// int64_t slot per treasure ID: slot i holds (offset + 1) of the active record
+// with ID i + 1 in treasures.dat, or 0 if there is none. data_size records the
+// size of treasures.dat the index describes, so an index left behind by an
+// older writer is detected and rebuilt.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int64_t data_size;
+} IndexHeader;
+
+// Per-hunt metadata block (hunts/<id>/meta). It is replaced atomically on
+// every add and remove, so the next ID never has to be found by scanning.
+// IDs are never reused, even after the top record is removed.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t next_id;               // ID given to the next added treasure
+    uint32_t flags;                // Reserved for per-hunt options
+    int64_t record_count;          // Records in treasures.dat, including removed ones
+    int64_t active_count;          // Active records
+    int64_t value_total;           // Sum of the values of active records
+    uint64_t generation;           // Incremented on every change
+    int64_t data_size;             // Size of treasures.dat this block describes
+} HuntMeta;
+
+// Header of the per-hunt score file (hunts/<id>/scores.dat), followed by
+// user_count ScoreEntry records (see score_table.h) with the totals of the active treasures.
+// generation is the meta generation the totals belong to: add and remove
+// update the file in the same operation, and a file from any other
+// generation is stale and recomputed from treasures.dat when read.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+    int64_t user_count;
+} ScoresHeader;
+
+// Sequential reader over treasures.dat. The file is memory-mapped and the
+// records walked in place (version 1 records are returned without a copy,
+// later versions are decoded into 'current'); if mmap fails the file is
+// read in large chunks instead.
+typedef struct {
+    int fd;
+    const char *hunt_id;
+    int format;                    // TREASURE_FORMAT_V1, _V2 or _V3
+    UserDict *dict;                // Names of version 3 user IDs
+    const char *data;              // Mapped file, or the read buffer
+    size_t len;                    // Bytes available in 'data'
+    size_t pos;                    // Next record in 'data'
+    void *map;                     // Mapping, NULL in buffered mode
+    size_t map_len;
+    char *buffer;                  // Read buffer in buffered mode
+    Treasure current;              // Last decoded record of version 2 or later
+    uint32_t user_id;              // Owner ID of the last version 3 record, or SCAN_NO_USER_ID
+    int resolve_names;             // Set by scan_open(); clear to leave version 3 usernames empty
+    off_t offset;                  // File offset of the last returned record
+    off_t next_offset;             // File offset of the next record
+} TreasureScan;
+
+// Function prototypes
+int list_hunts(void);
+int list_treasures(const char *hunt_id);
+int view_treasure(const char *hunt_id, int treasure_id);
+int remove_treasure(const char *hunt_id, int treasure_id);
+int open_treasure_file(const char *hunt_id);
+void close_treasure_files(void);
+void remove_hunt(const char *hunt_id);
+long long compact_hunt(const char *hunt_id, double threshold);
+void set_auto_compact(const char *hunt_id, double threshold);
+void log_operation(const char *hunt_id, const char *operation);
+void create_symlink(const char *hunt_id);
+void ensure_hunt_directory(const char *hunt_id);
+int get_next_treasure_id(const char *hunt_id);
+char* get_treasure_file_path(const char *hunt_id);
+char* get_log_file_path(const char *hunt_id);
+char* get_index_file_path(const char *hunt_id);
+int treasure_file_format(int fd);
+off_t treasure_data_start(int format);
+size_t encode_treasures(const char *hunt_id, int format, const Treasure *records, size_t count,
+                        char *buffer, off_t base, off_t *offsets);
+int read_treasure_at(const char *hunt_id, int fd, int format, off_t offset, Treasure *treasure);
+int set_treasure_active(int fd, int format, off_t offset, int active);
+int mark_treasure_removed(int fd, int format, off_t offset);
+int open_treasure_append(const char *hunt_id, int *format);
+int rebuild_treasure_index(const char *hunt_id);
+void index_add_entries(const char *hunt_id, int first_id, size_t count, const off_t *offsets,
+                       off_t start_size, off_t data_size);
+void index_remove_entry(const char *hunt_id, int treasure_id, off_t data_size);
+int open_index(const char *hunt_id, off_t data_size, int flags);
+off_t index_lookup(const char *hunt_id, int treasure_id, off_t data_size);
+int find_treasure(const char *hunt_id, int fd, int treasure_id, Treasure *treasure, off_t *position);
+int scan_open(TreasureScan *scan, const char *hunt_id, int fd);
+const Treasure* scan_next(TreasureScan *scan);
+void scan_close(TreasureScan *scan);
+char* get_meta_file_path(const char *hunt_id);
+int read_hunt_meta(const char *hunt_id, HuntMeta *meta);
+int write_hunt_meta(const char *hunt_id, const HuntMeta *meta);
+int rebuild_hunt_meta(const char *hunt_id, HuntMeta *meta);
+int load_hunt_meta(const char *hunt_id, HuntMeta *meta, off_t data_size);
+void meta_records_added(const char *hunt_id, int last_id, int64_t count, int64_t value_total,
+                        off_t offset, off_t data_size, const ScoreTable *scores);
+void meta_record_removed(const char *hunt_id, const Treasure *treasure, off_t data_size);
+char* get_scores_file_path(const char *hunt_id);
+int read_hunt_scores(const char *hunt_id, ScoreTable *table, uint64_t *generation);
+int write_hunt_scores(const char *hunt_id, const ScoreTable *table, uint64_t generation);
+int rebuild_hunt_scores(const char *hunt_id, ScoreTable *table, uint64_t generation);
+int load_hunt_scores(const char *hunt_id, ScoreTable *table);
+int open_hunt_scores(const char *hunt_id, ScoresHeader *header);
+void scores_update(const char *hunt_id, const ScoreTable *delta, uint64_t generation, uint64_t new_generation);
+void format_time(time_t time_value, char *buffer);
+void delete_file(const char *filepath);
+void create_link(const char *target, const char *linkpath);
+
+#endif
@@ -0,0 +1,303 @@
+#define _DEFAULT_SOURCE  // pread, strdup
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "treasure_store.h"
+#include "user_dict.h"
+
+#define USER_DICT_READ_SIZE 65536   // Bytes per read() when loading a dictionary
+
+typedef struct {
+    UserDict dict;
+    int append_fd;                 // Opened on the first new name, -1 until then
+} CachedUserDict;
+
+static CachedUserDict dict_cache[USER_DICT_CACHE_SIZE];
+static int dict_cache_next = 0;     // Slot replaced by the next miss
+
+// Get the path to the user dictionary of a hunt
+char* get_user_dict_path(const char *hunt_id) {
+    static char dict_path[MAX_PATH];
+    
+    strcpy(dict_path, HUNT_DIR_PREFIX);
+    strcat(dict_path, hunt_id);
+    strcat(dict_path, "/users.dict");
+    
+    return dict_path;
+}
+
+// Forget everything loaded for a cache entry, keeping it for the same hunt
+static int user_dict_reset(CachedUserDict *entry) {
+    if (entry->dict.names.slots) {
+        score_table_free(&entry->dict.names);
+    }
+    if (entry->append_fd != -1) {
+        close(entry->append_fd);
+        entry->append_fd = -1;
+    }
+    entry->dict.loaded_size = 0;
+    entry->dict.dev = 0;
+    entry->dict.ino = 0;
+    
+    if (score_table_init(&entry->dict.names) == -1) {
+        entry->dict.names.slots = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Load the entries between loaded_size and the end of the open file. A
+// partial entry at the end is left for the next load. Returns 0 on success.
+static int user_dict_load_more(UserDict *dict, int fd, off_t size) {
+    static char buffer[USER_DICT_READ_SIZE];
+    char name[MAX_USERNAME];
+    UserDictHeader header;
+    
+    if (dict->loaded_size == 0) {
+        if (size < (off_t)sizeof(header)) {
+            return 0;
+        }
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+            header.magic != USER_DICT_MAGIC || header.version != USER_DICT_VERSION) {
+            fprintf(stderr, "Invalid user dictionary for hunt '%s'\n", dict->hunt_id);
+            return -1;
+        }
+        dict->loaded_size = sizeof(header);
+    }
+    
+    while (dict->loaded_size < size) {
+        size_t want = size - dict->loaded_size < USER_DICT_READ_SIZE ?
+                      (size_t)(size - dict->loaded_size) : USER_DICT_READ_SIZE;
+        ssize_t bytes_read = pread(fd, buffer, want, dict->loaded_size);
+        size_t pos = 0;
+        
+        if (bytes_read <= 0) {
+            return bytes_read == 0 ? 0 : -1;
+        }
+        
+        // Entries are a length byte and that many name bytes
+        while (pos < (size_t)bytes_read) {
+            size_t len = (unsigned char)buffer[pos];
+            
+            if (pos + 1 + len > (size_t)bytes_read) {
+                break;
+            }
+            if (len >= MAX_USERNAME) {
+                fprintf(stderr, "Invalid user dictionary for hunt '%s'\n", dict->hunt_id);
+                return -1;
+            }
+            memcpy(name, buffer + pos + 1, len);
+            name[len] = '\0';
+            // Two writers may have appended the same name: each copy
+            // still owns the ID of its position
+            if (score_table_append(&dict->names, name, 0, 0) == -1) {
+                perror("Failed to allocate user dictionary");
+                return -1;
+            }
+            pos += 1 + len;
+        }
+        
+        // Only a partial entry at the very end of the file is left behind
+        if (pos == 0) {
+            return 0;
+        }
+        dict->loaded_size += pos;
+    }
+    
+    return 0;
+}
+
+// Get the in-memory dictionary of a hunt, loading it on first use and
+// catching up with entries appended since. A hunt without a dictionary
+// file has an empty one. Returns NULL on error.
+UserDict* user_dict_get(const char *hunt_id) {
+    CachedUserDict *entry = NULL;
+    struct stat file_stat;
+    int fd;
+    
+    for (int i = 0; i < USER_DICT_CACHE_SIZE; i++) {
+        if (dict_cache[i].dict.hunt_id && strcmp(dict_cache[i].dict.hunt_id, hunt_id) == 0) {
+            entry = &dict_cache[i];
+            break;
+        }
+    }
+    
+    // Not cached: take over the next slot
+    if (!entry) {
+        entry = &dict_cache[dict_cache_next];
+        dict_cache_next = (dict_cache_next + 1) % USER_DICT_CACHE_SIZE;
+        
+        if (entry->dict.hunt_id) {
+            free(entry->dict.hunt_id);
+        } else {
+            entry->append_fd = -1;
+        }
+        entry->dict.hunt_id = strdup(hunt_id);
+        if (!entry->dict.hunt_id || user_dict_reset(entry) == -1) {
+            perror("Failed to allocate user dictionary");
+            free(entry->dict.hunt_id);
+            entry->dict.hunt_id = NULL;
+            return NULL;
+        }
+    }
+    
+    fd = open(get_user_dict_path(hunt_id), O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            perror("Failed to open user dictionary");
+            return NULL;
+        }
+        // No dictionary (any more): nothing is known about the hunt's users
+        if (entry->dict.loaded_size > 0 && user_dict_reset(entry) == -1) {
+            return NULL;
+        }
+        return &entry->dict;
+    }
+    
+    if (fstat(fd, &file_stat) == -1) {
+        perror("Failed to get file stats");
+        close(fd);
+        return NULL;
+    }
+    
+    // A different file than the one loaded: start over
+    if (file_stat.st_dev != entry->dict.dev || file_stat.st_ino != entry->dict.ino ||
+        file_stat.st_size < entry->dict.loaded_size) {
+        if (user_dict_reset(entry) == -1) {
+            close(fd);
+            return NULL;
+        }
+        entry->dict.dev = file_stat.st_dev;
+        entry->dict.ino = file_stat.st_ino;
+    }
+    
+    if (user_dict_load_more(&entry->dict, fd, file_stat.st_size) == -1) {
+        close(fd);
+        user_dict_reset(entry);
+        return NULL;
+    }
+    
+    close(fd);
+    return &entry->dict;
+}
+
+// Name of a user ID, or NULL if the dictionary does not know it
+const char* user_dict_name(const UserDict *dict, uint32_t user_id) {
+    if (user_id >= dict->names.user_count) {
+        return NULL;
+    }
+    
+    return dict->names.users[user_id].name;
+}
+
+// Get the ID of a user name the dictionary already holds, without
+// touching the file. Returns 0 if found, -1 if not.
+int user_dict_find(const UserDict *dict, const char *name, uint32_t *user_id) {
+    size_t len = strnlen(name, MAX_USERNAME - 1);
+    char short_name[MAX_USERNAME];
+    long index;
+    
+    // Names are stored at most MAX_USERNAME - 1 bytes long
+    memcpy(short_name, name, len);
+    short_name[len] = '\0';
+    
+    index = score_table_find(&dict->names, short_name);
+    if (index == -1) {
+        return -1;
+    }
+    *user_id = (uint32_t)index;
+    return 0;
+}
+
+// Get the ID of a user name, appending it to the dictionary file if it
+// is new. The caller holds the hunt's write lock, which keeps two
+// processes from appending the same name. Returns 0 on success, -1 on
+// error.
+int user_dict_intern(UserDict *dict, const char *name, uint32_t *user_id) {
+    CachedUserDict *entry = (CachedUserDict *)dict;
+    char record[sizeof(UserDictHeader) + 1 + MAX_USERNAME];
+    size_t len = strnlen(name, MAX_USERNAME - 1);
+    size_t record_len = 0;
+    char short_name[MAX_USERNAME];
+    struct stat file_stat;
+    long index;
+    
+    if (user_dict_find(dict, name, user_id) == 0) {
+        return 0;
+    }
+    memcpy(short_name, name, len);
+    short_name[len] = '\0';
+    
+    if (entry->append_fd == -1) {
+        entry->append_fd = open(get_user_dict_path(dict->hunt_id), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (entry->append_fd == -1) {
+            perror("Failed to open user dictionary");
+            return -1;
+        }
+    }
+    
+    // Catch up first if the file has grown (or was replaced) since it was
+    // loaded, so the new entry gets the ID of its position
+    if (fstat(entry->append_fd, &file_stat) == -1) {
+        perror("Failed to get file stats");
+        return -1;
+    }
+    if (file_stat.st_size != dict->loaded_size) {
+        if ((file_stat.st_dev != dict->dev || file_stat.st_ino != dict->ino) && dict->loaded_size > 0) {
+            fprintf(stderr, "User dictionary of hunt '%s' was replaced\n", dict->hunt_id);
+            return -1;
+        }
+        dict->dev = file_stat.st_dev;
+        dict->ino = file_stat.st_ino;
+        if (user_dict_load_more(dict, entry->append_fd, file_stat.st_size) == -1) {
+            return -1;
+        }
+        index = score_table_find(&dict->names, short_name);
+        if (index != -1) {
+            *user_id = (uint32_t)index;
+            return 0;
+        }
+    }
+    
+    if (dict->loaded_size == 0) {
+        UserDictHeader header = { USER_DICT_MAGIC, USER_DICT_VERSION };
+        memcpy(record, &header, sizeof(header));
+        record_len = sizeof(header);
+    }
+    record[record_len] = (char)len;
+    memcpy(record + record_len + 1, short_name, len);
+    record_len += 1 + len;
+    
+    if (write(entry->append_fd, record, record_len) != (ssize_t)record_len) {
+        perror("Failed to write user dictionary");
+        return -1;
+    }
+    if (score_table_add(&dict->names, short_name, 0, 0) == -1) {
+        perror("Failed to allocate user dictionary");
+        return -1;
+    }
+    
+    dict->loaded_size += record_len;
+    dict->dev = file_stat.st_dev;
+    dict->ino = file_stat.st_ino;
+    *user_id = (uint32_t)(dict->names.user_count - 1);
+    return 0;
+}
+
+// Delete the dictionary file of a hunt and forget the cached copy
+void user_dict_remove(const char *hunt_id) {
+    for (int i = 0; i < USER_DICT_CACHE_SIZE; i++) {
+        if (dict_cache[i].dict.hunt_id && strcmp(dict_cache[i].dict.hunt_id, hunt_id) == 0) {
+            user_dict_reset(&dict_cache[i]);
+        }
+    }
+    
+    delete_file(get_user_dict_path(hunt_id));
+}
@@ -0,0 +1,40 @@
+#ifndef USER_DICT_H
+#define USER_DICT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "score_table.h"
+
+#define USER_DICT_MAGIC 0x54434455  // "UDCT"
+#define USER_DICT_VERSION 1
+#define USER_DICT_CACHE_SIZE 16     // Dictionaries kept in memory between queries
+
+// Header of the per-hunt user dictionary (hunts/<id>/users.dict). It is
+// followed by one entry per user: a length byte and the name without a
+// terminator. The position of an entry is the user's 32-bit ID. Entries
+// are only ever appended, so an ID stays valid for the life of the hunt
+// and a reader that has loaded part of the file only needs the rest.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} UserDictHeader;
+
+// In-memory copy of a hunt's dictionary
+typedef struct {
+    char *hunt_id;
+    ScoreTable names;              // names.users[id].name is the name of user id
+    off_t loaded_size;             // Bytes of users.dict already loaded
+    dev_t dev;
+    ino_t ino;
+} UserDict;
+
+// Function prototypes
+char* get_user_dict_path(const char *hunt_id);
+UserDict* user_dict_get(const char *hunt_id);
+const char* user_dict_name(const UserDict *dict, uint32_t user_id);
+int user_dict_find(const UserDict *dict, const char *name, uint32_t *user_id);
+int user_dict_intern(UserDict *dict, const char *name, uint32_t *user_id);
+void user_dict_remove(const char *hunt_id);
+
+#endif